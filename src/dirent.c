@@ -49,7 +49,7 @@ int readdir_r(Thread *t, uint64_t id, DIR *dir, struct dirent *entry, struct dir
     // input validation
     int dd = (intptr_t) dir & ~(DIRECTORY_DESCRIPTOR_FLAG);
     if(dd < 0 || dd >= MAX_IO_DESCRIPTORS) return -EBADF;
-    if(!p->io[dd].valid || p->io[dd].type != IO_DIRECTORY) return -EBADF;
+    if(dd >= p->iodMax || !p->io[dd].valid || p->io[dd].type != IO_DIRECTORY) return -EBADF;
 
     DirectoryDescriptor *descriptor = (DirectoryDescriptor *) p->io[dd].data;
     if(!descriptor) return -EBADF;
@@ -75,7 +75,7 @@ void seekdir(Thread *t, DIR *dir, long position) {
 
     int dd = (intptr_t) dir & ~(DIRECTORY_DESCRIPTOR_FLAG);
     if(dd < 0 || dd >= MAX_IO_DESCRIPTORS) return;
-    if(!p->io[dd].valid || p->io[dd].type != IO_DIRECTORY) return;
+    if(dd >= p->iodMax || !p->io[dd].valid || p->io[dd].type != IO_DIRECTORY) return;
 
     DirectoryDescriptor *descriptor = (DirectoryDescriptor *) p->io[dd].data;
     if(!descriptor) return;
@@ -90,7 +90,7 @@ long telldir(Thread *t, DIR *dir) {
 
     int dd = (intptr_t) dir & ~(DIRECTORY_DESCRIPTOR_FLAG);
     if(dd < 0 || dd >= MAX_IO_DESCRIPTORS) return -EBADF;
-    if(!p->io[dd].valid || p->io[dd].type != IO_DIRECTORY) return -EBADF;
+    if(dd >= p->iodMax || !p->io[dd].valid || p->io[dd].type != IO_DIRECTORY) return -EBADF;
 
     DirectoryDescriptor *descriptor = (DirectoryDescriptor *) p->io[dd].data;
     if(!descriptor) return -EBADF;
@@ -104,17 +104,15 @@ int closedir(Thread *t, DIR *dir) {
 
     int dd = (intptr_t) dir & ~(DIRECTORY_DESCRIPTOR_FLAG);
     if(dd < 0 || dd >= MAX_IO_DESCRIPTORS) return -EBADF;
-    if(!p->io[dd].valid || p->io[dd].type != IO_DIRECTORY) return -EBADF;
+    if(dd >= p->iodMax || !p->io[dd].valid || p->io[dd].type != IO_DIRECTORY) return -EBADF;
 
     DirectoryDescriptor *descriptor = (DirectoryDescriptor *) p->io[dd].data;
     if(!descriptor) return -EBADF;
 
     // destroy the descriptor
-    p->io[dd].valid = false;
+    closeIO(p, &p->io[dd]);
     p->io[dd].type = 0;
     p->io[dd].flags = 0;
-    p->io[dd].data = NULL;
-    p->iodCount--;
 
     return 0;
 }
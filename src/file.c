@@ -17,6 +17,8 @@
 #include <kernel/io.h>
 #include <kernel/sched.h>
 #include <kernel/socket.h>
+#include <kernel/poll.h>
+#include <kernel/pipe.h>
 #include <kernel/servers.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -73,7 +75,7 @@ int fstat(Thread *t, uint64_t id, int fd, struct stat *buffer) {
     Process *p = getProcess(t->pid);
     if(!p) return -ESRCH;
     if(fd < 0 || fd >= MAX_IO_DESCRIPTORS) return -EBADF;
-    if(!p->io[fd].valid || !p->io[fd].data) return -EBADF;  // ensure valid file descriptor
+    if(fd >= p->iodMax || !p->io[fd].valid || !p->io[fd].data) return -EBADF;  // ensure valid file descriptor
 
     if(p->io[fd].type == IO_FILE) {
         FileDescriptor *file = (FileDescriptor *) p->io[fd].data;
@@ -88,6 +90,15 @@ int fstat(Thread *t, uint64_t id, int fd, struct stat *buffer) {
         buffer->st_dev = 1;
         buffer->st_nlink = 1;
         return 1;
+    } else if(p->io[fd].type == IO_PIPE) {
+        memset(buffer, 0, sizeof(struct stat));
+        buffer->st_mode = S_IFIFO|S_IRUSR|S_IWUSR;
+        buffer->st_uid = p->user;
+        buffer->st_gid = p->group;
+        buffer->st_ino = (ino_t)(uintptr_t) p->io[fd].data;
+        buffer->st_dev = 1;
+        buffer->st_nlink = 1;
+        return 1;
     }
 
     return -EBADF;  // TODO: shared memory and typed memory objects
@@ -124,6 +135,71 @@ int open(Thread *t, uint64_t id, const char *path, int flags, mode_t mode) {
     return status;
 }
 
+/* fileHandleRW(): relays read() or write() on a file with a server-assigned handle
+ * params: t - calling thread
+ * params: p - calling process
+ * params: id - syscall request ID
+ * params: iod - I/O descriptor of the file
+ * params: buffer - data to write, NULL for read()
+ * params: count - number of bytes to read or write
+ * returns: zero on success, negative error code on fail
+ */
+
+static ssize_t fileHandleRW(Thread *t, Process *p, uint64_t id, IODescriptor *iod, const void *buffer, size_t count) {
+    FileDescriptor *fd = (FileDescriptor *) iod->data;
+    size_t length = sizeof(HandleRWCommand) + (buffer ? count : 0);
+
+    HandleRWCommand *command = calloc(1, length);
+    if(!command) return -ENOMEM;
+
+    command->header.header.command = buffer ? COMMAND_HANDLE_WRITE : COMMAND_HANDLE_READ;
+    command->header.header.length = length;
+    command->header.id = id;
+    command->handle = fd->handle;
+    command->id = fd->id;
+    command->uid = p->user;
+    command->gid = p->group;
+    command->flags = iod->flags;
+    command->length = count;
+
+    if(buffer && (iod->flags & O_APPEND)) command->position = -1;
+    else command->position = fd->position;
+
+    if(buffer) {
+        memcpy(command->data, buffer, count);
+        if(fd->charDev) command->silent = 1;
+    }
+
+    int status = requestServer(t, fd->sd, command);
+    free(command);
+    return status;
+}
+
+/* fileHandleFsync(): relays fsync() or close() on a file with a server-assigned handle
+ * params: t - calling thread
+ * params: p - calling process
+ * params: id - syscall request ID
+ * params: file - file descriptor
+ * params: closing - non-zero for close()
+ * returns: zero on success, negative error code on fail
+ */
+
+static int fileHandleFsync(Thread *t, Process *p, uint64_t id, FileDescriptor *file, int closing) {
+    HandleFsyncCommand command;
+    memset(&command, 0, sizeof(HandleFsyncCommand));
+
+    command.header.header.command = COMMAND_HANDLE_FSYNC;
+    command.header.header.length = sizeof(HandleFsyncCommand);
+    command.header.id = id;
+    command.handle = file->handle;
+    command.id = file->id;
+    command.uid = p->user;
+    command.gid = p->group;
+    command.close = closing;
+
+    return requestServer(t, file->sd, &command);
+}
+
 ssize_t readFile(Thread *t, uint64_t id, IODescriptor *iod, void *buffer, size_t count) {
     Process *p = getProcess(t->pid);
     if(!p) return -ESRCH;
@@ -133,6 +209,9 @@ ssize_t readFile(Thread *t, uint64_t id, IODescriptor *iod, void *buffer, size_t
 
     if(!(iod->flags & O_RDONLY)) return -EPERM;
 
+    // servers that assigned a handle don't need the paths again
+    if(fd->handle) return fileHandleRW(t, p, id, iod, NULL, count);
+
     RWCommand *command = calloc(1, sizeof(RWCommand));
     if(!command) return -ENOMEM;
 
@@ -162,6 +241,7 @@ ssize_t writeFile(Thread *t, uint64_t id, IODescriptor *iod, const void *buffer,
     if(!fd) return -EBADF;
 
     if(!(iod->flags & O_WRONLY)) return -EPERM;
+    if(fd->handle) return fileHandleRW(t, p, id, iod, buffer, count);
 
     RWCommand *command = calloc(1, sizeof(RWCommand) + count);
     if(!command) return -ENOMEM;
@@ -199,16 +279,29 @@ int closeFile(Thread *t, uint64_t id, int fd) {
     else p = getProcess(getKernelPID());
     if(!p) return -ESRCH;
 
+    if(fd >= p->iodMax) return -EBADF;
     FileDescriptor *file = (FileDescriptor *) p->io[fd].data;
     if(!file) return -EBADF;
 
-    if((!(p->io[fd].flags & O_WRONLY)) || file->charDev) {
+    // the last close of a file with a handle always reaches the server so
+    // that it can release the handle
+    if(((!(p->io[fd].flags & O_WRONLY)) || file->charDev) && (!file->handle || (file->refCount > 1))) {
         file->refCount--;
         if(!file->refCount) free(file);
         closeIO(p, &p->io[fd]);
         return 1;   // non-blocking
     }
 
+    if(file->handle) {
+        if(file->refCount == 1) return fileHandleFsync(t, p, id, file, 1);
+
+        // other descriptors still use the handle, so only sync the data and
+        // drop this reference
+        file->refCount--;
+        closeIO(p, &p->io[fd]);
+        return fileHandleFsync(t, p, id, file, 0);
+    }
+
     // syncing is only necessary for files that have been written to
     FsyncCommand *cmd = calloc(1, sizeof(FsyncCommand));
     if(!cmd) return -ENOMEM;
@@ -236,6 +329,7 @@ off_t lseek(Thread *t, int fd, off_t offset, int where) {
     else p = getProcess(getKernelPID());
     if(!p) return -ESRCH;
 
+    if(fd >= p->iodMax) return -EBADF;
     FileDescriptor *file = (FileDescriptor *) p->io[fd].data;
     if(!file) return -EBADF;
 
@@ -263,7 +357,7 @@ int fcntl(Thread *t, int fd, int cmd, uintptr_t arg) {
     Process *p = getProcess(t->pid);
     if(!p) return -ESRCH;
 
-    if(!p->io[fd].valid) return -EBADF;
+    if(fd >= p->iodMax || !p->io[fd].valid) return -EBADF;
     FileDescriptor *file;
 
     int status = 0;
@@ -279,7 +373,7 @@ int fcntl(Thread *t, int fd, int cmd, uintptr_t arg) {
         int dupfd = openIO(p, (void **) &iod);
         if(dupfd < 0) return dupfd;
         if(dupfd < arg) {
-            iod->valid = false;
+            closeIO(p, iod);
             return -EMFILE;
         }
 
@@ -293,6 +387,11 @@ int fcntl(Thread *t, int fd, int cmd, uintptr_t arg) {
         } else if(iod->type == IO_SOCKET) {
             SocketDescriptor *socket = (SocketDescriptor *) iod->data;
             socket->refCount++;
+        } else if(iod->type == IO_EPOLL) {
+            Epoll *epoll = (Epoll *) iod->data;
+            epoll->refCount++;
+        } else if(iod->type == IO_PIPE) {
+            pipeShare(iod);
         }
 
         iod->flags &= ~(FD_CLOEXEC | FD_CLOFORK);
@@ -609,11 +708,12 @@ int fsync(Thread *t, uint64_t id, int fd) {
     Process *p = getProcess(t->pid);
     if(!p) return -ESRCH;
     if(fd < 0 || fd >= MAX_IO_DESCRIPTORS) return -EBADF;
-    if(!p->io[fd].valid) return -EBADF;
+    if(fd >= p->iodMax || !p->io[fd].valid) return -EBADF;
     if(p->io[fd].type != IO_FILE) return -EINVAL;
 
     FileDescriptor *file = (FileDescriptor *) p->io[fd].data;
     if(!file) return -EBADF;
+    if(file->handle) return fileHandleFsync(t, p, id, file, 0);
 
     FsyncCommand *cmd = calloc(1, sizeof(FsyncCommand));
     if(!cmd) return -ENOMEM;
@@ -664,7 +764,7 @@ int fstatvfs(Thread *t, uint64_t id, int fd, struct statvfs *buf) {
 
     Process *p = getProcess(t->pid);
     if(!p) return -ESRCH;
-    if(!p->io[fd].valid || (p->io[fd].type != IO_FILE)) return -EBADF;
+    if(fd >= p->iodMax || !p->io[fd].valid || (p->io[fd].type != IO_FILE)) return -EBADF;
 
     FileDescriptor *file = p->io[fd].data;
     if(!file) return -EBADF;
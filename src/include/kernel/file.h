@@ -67,6 +67,7 @@ typedef struct {
     int charDev;                    // character device boolean
     int refCount;
     int sd;                         // socket descriptor of relevant driver
+    uint64_t handle;                // assigned by the driver, zero if it needs paths
 } FileDescriptor;
 
 /* file lock structure */
@@ -13,12 +13,22 @@
 #include <stdbool.h>
 #include <kernel/sched.h>
 
+// the limit can be changed at build time with -DMAX_IO_DESCRIPTORS=n
+#ifndef MAX_IO_DESCRIPTORS
 #define MAX_IO_DESCRIPTORS      1024    // max files/sockets open per process
+#endif
+#define IO_DESCRIPTORS_INITIAL  64      // initial size of the descriptor table
+
+#if MAX_IO_DESCRIPTORS > 4096 || MAX_IO_DESCRIPTORS % 64 || IO_DESCRIPTORS_INITIAL % 64
+#error "descriptor table bitmaps assume a multiple of 64 descriptors and at most 4096"
+#endif
 
 #define IO_WAITING              1   // only used during setup
 #define IO_FILE                 2
 #define IO_SOCKET               3
 #define IO_DIRECTORY            4
+#define IO_EPOLL                5
+#define IO_PIPE                 6
 
 /* I/O descriptor flags */
 #define O_NONBLOCK              0x0001
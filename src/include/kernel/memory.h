@@ -21,6 +21,14 @@
 
 #define PMM_CONTIGUOUS_LOW      0x01
 
+// page coloring; color sets are bitmaps of up to this many colors
+#define PMM_MAX_COLORS          64
+
+// DMA pool, reserved at boot below 4 GB before physical memory fragments
+#define DMA_POOL_DIVISOR        32          // fraction of usable memory to reserve
+#define DMA_POOL_MIN_PAGES      256         // 1 MiB
+#define DMA_POOL_MAX_PAGES      16384       // 64 MiB
+
 // these flags control allocated memory
 #define VMM_USER                0x01        // kernel-user toggle
 #define VMM_EXEC                0x02
@@ -39,9 +47,14 @@
 #define VMM_PAGE_SWAP_MASK      0xE00000
 #define VMM_PAGE_SWAP           0x200000    // swap from disk
 #define VMM_PAGE_ALLOCATE       0x400000    // allocate physical memory
+#define VMM_PAGE_GUARD          0x600000    // guard page, never accessible
 
 // TODO: adjust bit masks and shifting here when implementing true swapping
 
+// fault-around: when a thread faults on pages in a steady stride, the page
+// fault handler also brings in up to this many neighbouring pages at once
+#define VMM_FAULT_AROUND_MAX    16
+
 // protection and flags for memory-mapped files
 #define PROT_READ               0x01
 #define PROT_WRITE              0x02
@@ -93,18 +106,31 @@ struct MmapSyscallParams {
 void pmmInit(KernelBootInfo *);
 void pmmStatus(PhysicalMemoryStatus *);
 uintptr_t pmmAllocate(void);
+uintptr_t pmmAllocateColor(uint64_t);
+int pmmColors();
 uintptr_t pmmAllocateContiguous(size_t, int);
 int pmmFree(uintptr_t);
+int pmmFreeBatch(const uintptr_t *, size_t);
 int pmmFreeContiguous(uintptr_t, size_t);
 
+void dmaInit();
+uintptr_t dmaAllocate(size_t, int);
+int dmaFree(uintptr_t, size_t);
+
 void vmmInit();
 uintptr_t vmmAllocate(uintptr_t, uintptr_t, size_t, int);
+int vmmGuard(uintptr_t, size_t);
 int vmmFree(uintptr_t, size_t);
 int vmmPageFault(uintptr_t, int);       // the platform-specific page fault handler must call this
 uintptr_t vmmMMIO(uintptr_t, bool);
 int vmmPageStatus(uintptr_t, uintptr_t *);
 uintptr_t vmmSetFlags(uintptr_t, size_t, int);
 
+int copyToUser(Thread *, void *, const void *, size_t);
+int copyFromUser(Thread *, void *, const void *, size_t);
+int userDetachPages(Thread *, uintptr_t, size_t, uintptr_t *);
+int userAttachPages(Thread *, uintptr_t, size_t, const uintptr_t *);
+
 void *sbrk(Thread *, intptr_t);
 
 uintptr_t mmio(Thread *, uintptr_t, off_t, int);
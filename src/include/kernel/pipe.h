@@ -0,0 +1,40 @@
+/*
+ * lux - a lightweight unix-like operating system
+ * Omar Elghoul, 2024
+ *
+ * Core Microkernel
+ */
+
+/* Anonymous Pipes */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <kernel/sched.h>
+#include <kernel/memory.h>
+#include <kernel/io.h>
+#include <platform/lock.h>
+
+#define PIPE_PAGES              16          // pages in the ring, power of two
+#define PIPE_SIZE               (PIPE_PAGES * PAGE_SIZE)
+#define PIPE_BUF                4096        // writes up to this size are atomic
+
+/* the read end of a pipe is opened with O_RDONLY and the write end with
+ * O_WRONLY, and the pipe counts how many descriptors refer to each end */
+typedef struct Pipe {
+    lock_t lock;
+    int readers, writers;
+    size_t head, count;                 // oldest byte and bytes in the ring
+    uintptr_t pages[PIPE_PAGES];        // physical, allocated as the ring fills
+    struct EpollItem *watchers;         // see poll.c
+} Pipe;
+
+int pipe(Thread *, int *, int);
+ssize_t pipeRead(Thread *, int, void *, size_t);
+ssize_t pipeWrite(Thread *, int, const void *, size_t);
+int pipePoll(Pipe *);
+void pipeShare(IODescriptor *);
+int closePipe(Thread *, int);
+void pipeRelease(Process *);
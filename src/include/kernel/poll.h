@@ -0,0 +1,81 @@
+/*
+ * lux - a lightweight unix-like operating system
+ * Omar Elghoul, 2024
+ *
+ * Core Microkernel
+ */
+
+/* Readiness Notification for I/O Descriptors */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <kernel/sched.h>
+
+#define POLLIN                  0x0001  // data can be read
+#define POLLPRI                 0x0002
+#define POLLOUT                 0x0004  // data can be written
+#define POLLERR                 0x0008
+#define POLLHUP                 0x0010  // peer disconnected
+#define POLLNVAL                0x0020  // not an open descriptor
+#define POLLRDNORM              POLLIN
+#define POLLWRNORM              POLLOUT
+
+#define EPOLLIN                 POLLIN
+#define EPOLLPRI                POLLPRI
+#define EPOLLOUT                POLLOUT
+#define EPOLLERR                POLLERR
+#define EPOLLHUP                POLLHUP
+#define EPOLLONESHOT            0x40000000  // disable after one event
+#define EPOLLET                 0x80000000  // edge-triggered
+
+#define EPOLL_CTL_ADD           1
+#define EPOLL_CTL_DEL           2
+#define EPOLL_CTL_MOD           3
+
+#define EPOLL_CLOEXEC           0x200       // same as SOCK_CLOEXEC
+
+typedef unsigned long nfds_t;
+
+struct pollfd {
+    int fd;
+    short events;
+    short revents;
+};
+
+struct epoll_event {
+    uint32_t events;
+    uint64_t data;
+} __attribute__((packed));
+
+/* every descriptor in an interest set has an item, which is linked both into
+ * the interest set and into the list of watchers of the object it refers to,
+ * so that the object can queue it on the ready list when its state changes */
+typedef struct EpollItem {
+    struct Epoll *epoll;
+    int fd, type;
+    void *object;               // socket or pipe
+    uint32_t events;
+    uint64_t data;
+    bool queued;                // on the ready list
+    struct EpollItem *next, *prev;      // in the interest set
+    struct EpollItem *nextReady;
+    struct EpollItem *nextWatcher;      // in the object's list of watchers
+} EpollItem;
+
+typedef struct Epoll {
+    int refCount;
+    EpollItem *items;
+    EpollItem *readyHead, *readyTail;
+} Epoll;
+
+void pollNotify(EpollItem **);
+void pollDetach(EpollItem **);
+int ioPoll(Process *, int);
+int poll(Thread *, struct pollfd *, nfds_t);
+int epoll_create(Thread *, int);
+int epoll_ctl(Thread *, int, int, int, struct epoll_event *);
+int epoll_wait(Thread *, int, struct epoll_event *, int);
+int closeEpoll(Thread *, int);
@@ -26,6 +26,10 @@ typedef struct Thread Thread;
 
 #define MAX_PID                 99999
 
+// address spaces of dead threads are freed in the background by idle CPUs,
+// roughly this many pages at a time
+#define RECLAIM_BATCH           512
+
 #define THREAD_QUEUED           0
 #define THREAD_RUNNING          1
 #define THREAD_BLOCKED          2       // waiting for I/O
@@ -78,6 +82,11 @@ struct Thread {
     void *signalContext;
 
     uintptr_t highest;
+    size_t stackSize;       // reserved stack size, zero for the platform default;
+                            // chosen by kthreadCreate(), inherited otherwise
+
+    uintptr_t faultAddress; // last page fault, for fault-around heuristics
+    int faultWindow;        // pages brought in after it, negative for downwards
 };
 
 struct Process {
@@ -89,15 +98,21 @@ struct Process {
     bool orphan;            // true when the parent process exits or is killed
     bool zombie;            // true when all threads are zombies
 
-    char command[ARG_MAX*32];   // command line with arguments
-    char name[MAX_PATH];        // file name
+    // allocated to fit, see processRename()
+    char *command;          // command line with arguments
+    char *name;             // file name
 
-    struct IODescriptor io[MAX_IO_DESCRIPTORS];
-    int iodCount;
+    // the descriptor table is allocated separately and grows on demand, with
+    // a bitmap of used slots and a summary of which bitmap words are full
+    struct IODescriptor *io;
+    uint64_t iodBitmap[MAX_IO_DESCRIPTORS/64];
+    uint64_t iodFull;
+    int iodCount, iodMax;
 
     char cwd[MAX_PATH];
 
     int pages;              // memory pages used
+    uint64_t colors;        // set of page colors to allocate from, zero for any
 
     size_t threadCount;
     size_t childrenCount;
@@ -127,8 +142,9 @@ Process *getProcessQueue();
 void schedStatus();
 bool schedBusy();
 
-pid_t kthreadCreate(void *(*)(void *), void *);
+pid_t kthreadCreate(void *(*)(void *), void *, size_t);
 pid_t processCreate();
+void processRename(Process *, const char *, const char *);
 int threadUseContext(pid_t);
 void setLocalSched(bool);
 
@@ -142,6 +158,8 @@ void terminateThread(Thread *, int, bool);
 void schedSleepTimer();
 Thread *getKernelThread();
 void threadCleanup(Thread *);
+void reclaimContext(void *);
+int reclaimStep();
 
 // these functions are exposed as system calls, but some will need to take
 // the thread as an argument from the system call handler - the actual user
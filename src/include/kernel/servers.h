@@ -30,8 +30,10 @@
 #define COMMAND_PROCESS_LIST    0x0005  // get list of processes/threads
 #define COMMAND_PROCESS_STATUS  0x0006  // get status of process/thread
 #define COMMAND_FRAMEBUFFER     0x0007  // request frame buffer access
+#define COMMAND_CACHE_COLORS    0x0008  // set the page colors of a process
+#define COMMAND_RING            0x0009  // register shared request rings
 
-#define MAX_GENERAL_COMMAND     0x0007
+#define MAX_GENERAL_COMMAND     0x0009
 
 /* these commands are requested by the kernel for lumen to fulfill syscall requests */
 #define COMMAND_STAT            0x8000
@@ -61,7 +63,12 @@
 #define COMMAND_READLINK        0x8016
 #define COMMAND_STATVFS         0x8017
 
-#define MAX_SYSCALL_COMMAND     0x8017
+/* compact forms of the above for files that the server assigned a handle to */
+#define COMMAND_HANDLE_READ     0x8018
+#define COMMAND_HANDLE_WRITE    0x8019
+#define COMMAND_HANDLE_FSYNC    0x801A
+
+#define MAX_SYSCALL_COMMAND     0x801A
 
 /* these commands are for device drivers */
 #define COMMAND_IRQ             0xC000
@@ -113,8 +120,69 @@ typedef struct {
     uint64_t buffer;        // pointer
     uint64_t bufferPhysical;
     uint16_t w, h, pitch, bpp;
+    uint16_t flags;         // mapping type, see below
 } FramebufferResponse;
 
+#define FRAMEBUFFER_WRITE_COMBINE   0x0001  // default
+#define FRAMEBUFFER_CACHED          0x0002  // requested to opt out of write-combining
+
+/* cache colors command */
+typedef struct {
+    MessageHeader header;
+    pid_t pid;
+    uint64_t colors;        // bitmap of allowed colors, zero for any
+    int count;              // number of colors supported, for responses
+} CacheColorsCommand;
+
+/* shared request rings; a server that registers them receives requests as
+ * fixed-size descriptors on the submission ring and returns responses on the
+ * completion ring, while the messages themselves live in numbered buffers of
+ * the same shared area, so relaying a request takes no socket operation
+ *
+ * a buffer belongs to the server from the submission of a request until the
+ * server posts a completion naming it; the response is written over the
+ * request in place, and a completion with zero length only returns a buffer
+ * whose response was too large and was sent over the socket instead */
+#define SERVER_RING_ENTRIES     64          // descriptors per ring, power of two
+#define SERVER_RING_BUFFERS     32          // message buffers
+#define SERVER_RING_BUFFER_SIZE SERVER_MAX_SIZE
+
+/* set by a server before it sleeps on its socket, so that the kernel follows
+ * the next submission with a COMMAND_RING message that wakes it up */
+#define SERVER_RING_WAKEUP      0x0001
+
+typedef struct {
+    uint16_t command;
+    uint16_t buffer;        // index of the buffer holding the message
+    uint32_t length;        // length of the message, zero to only return the buffer
+    pid_t requester;
+} RingDescriptor;
+
+/* the producer advances the tail and the consumer advances the head, and both
+ * are free-running counters that are masked to index the entries */
+typedef struct {
+    uint32_t head, tail;
+    RingDescriptor entries[SERVER_RING_ENTRIES];
+} RingQueue;
+
+typedef struct {
+    uint32_t flags;         // SERVER_RING_*, written by the server
+    uint32_t reserved;
+    RingQueue submission;   // requests from the kernel
+    RingQueue completion;   // responses from the server
+} RingHeader;
+
+/* ring registration command */
+typedef struct {
+    MessageHeader header;
+    uint64_t base;          // user address of the shared area, for responses
+    uint64_t size;          // size of the shared area in bytes
+    uint64_t buffers;       // offset of the first message buffer in the area
+    uint64_t bufferSize;
+    int bufferCount;
+    int entries;            // descriptors per ring
+} RingCommand;
+
 /* mount command */
 typedef struct {
     SyscallHeader header;
@@ -163,6 +231,7 @@ typedef struct {
     gid_t gid;
     uint64_t id;    // unique ID
     int charDev;
+    uint64_t handle;    // set by servers that take compact commands, zero otherwise
 } OpenCommand;
 
 /* read() and write() */
@@ -180,6 +249,31 @@ typedef struct {
     uint64_t data[];    // for alignment
 } RWCommand;
 
+/* read() and write() on a file with a server-assigned handle, which carry no
+ * paths and only as much data as is actually written */
+typedef struct {
+    SyscallHeader header;
+    int silent;         // request no response
+    uint64_t handle;
+    uint64_t id;
+    int flags;
+    uid_t uid;
+    gid_t gid;
+    off_t position;
+    size_t length;
+    uint64_t data[];
+} HandleRWCommand;
+
+/* fsync() and close() on a file with a server-assigned handle */
+typedef struct {
+    SyscallHeader header;
+    uint64_t handle;
+    uint64_t id;
+    uid_t uid;
+    gid_t gid;
+    int close;          // 0 for fsync(), non-zero for close()
+} HandleFsyncCommand;
+
 /* IRQ Notification */
 typedef struct {
     MessageHeader header;
@@ -365,4 +459,9 @@ void serverIdle();
 void handleGeneralRequest(int, const MessageHeader *, void *);
 void handleSyscallResponse(int, const SyscallHeader *);
 int requestServer(Thread *, int, void *);
-int serverSocket(const char *);
\ No newline at end of file
+int serverSocket(const char *);
+int serverRingCreate(Thread *, int, RingCommand *);
+int serverRingSubmit(int, void *);
+void serverRingIdle();
+void serverRingClose(int);
+void serverRingRelease(pid_t);
\ No newline at end of file
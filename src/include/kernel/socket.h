@@ -16,15 +16,39 @@
 
 /* system-wide limits */
 #define MAX_SOCKETS             (1 << 18)   // 262k
+#define SOCKET_TABLE_INITIAL    256         // initial size of the socket table
 #define SOCKET_DEFAULT_BACKLOG  1024        // default socket backlog size
+#define SOCKET_HASH_BUCKETS     4096        // buckets for named socket lookup, power of two
 
-#define SOCKET_IO_BACKLOG       64          // default I/O backlog size
+#define SOCKET_IO_BACKLOG       64          // default I/O backlog size, power of two
+#define SOCKET_INLINE_SIZE      256         // messages up to this size are queued inline
+#define SOCKET_STREAM_INITIAL   16384       // initial stream buffer size, power of two
+#define SOCKET_MMSG_MAX         64          // messages per sendmmsg() and recvmmsg()
+
+/* default limits on data queued on a socket before senders block; a single
+ * message larger than the limit is still accepted into an empty queue */
+#define SOCKET_DEFAULT_BUFFER   1048576     // bytes, for SO_SNDBUF and SO_RCVBUF
+#define SOCKET_DEFAULT_MESSAGES 4096        // messages, for SO_RCVMSGS
+#define SOCKET_MIN_BUFFER       4096
+
+/* larger messages are stored in pooled buffers of one to 16 pages, each
+ * leaving room for the kernel heap's allocation header */
+#define SOCKET_POOL_CLASSES     5
+#define SOCKET_POOL_DEPTH       32          // maximum free buffers per class per CPU
+#define SOCKET_POOL_SIZE(c)     ((PAGE_SIZE << (c)) - 64)
+
+/* page-aligned messages of at least this size sent with MSG_ZEROCOPY have
+ * their pages moved to the receiver instead of being copied */
+#define SOCKET_ZEROCOPY_MIN     65536
+#define SOCKET_MESSAGE_PAGES    ((size_t)1 << 63)   // set in the queued length
+#define SOCKET_MESSAGE_LENGTH(l)    ((l) & ~SOCKET_MESSAGE_PAGES)
 
 /* socket family/domain - only Unix sockets will be implemented in the kernel */
 #define AF_UNIX                 1
 #define AF_LOCAL                AF_UNIX
 
-/* socket type - these will be ignored for local Unix sockets */
+/* socket type - stream sockets receive into a contiguous byte stream and
+ * every other type preserves message boundaries */
 /* the kernel will ensure packets are sent and received in the same order */
 #define SOCK_STREAM             1       // stream-oriented
 #define SOCK_DGRAM              2       // datagram-oriented
@@ -38,6 +62,15 @@
 #define MSG_PEEK                0x01
 #define MSG_OOB                 0x02
 #define MSG_WAITALL             0x04
+#define MSG_ZEROCOPY            0x08    // move the pages of the buffer, see send()
+
+/* socket options */
+#define SOL_SOCKET              1
+
+#define SO_TYPE                 1       // read-only
+#define SO_SNDBUF               2       // bytes in flight to the peer
+#define SO_RCVBUF               3       // bytes queued for receiving
+#define SO_RCVMSGS              4       // messages queued for receiving
 
 typedef uint16_t sa_family_t;
 typedef size_t socklen_t;
@@ -54,6 +87,23 @@ struct sockaddr_un {
     char sun_path[512];         // filename
 };
 
+/* parameters for setsockopt() and getsockopt(), passed in memory */
+struct SockoptSyscallParams {
+    int sd;
+    int level;
+    int option;
+    void *value;
+    socklen_t len;              // updated by getsockopt()
+};
+
+/* one message of a batch for sendmmsg() and recvmmsg(); there is no
+ * scatter/gather, so each message is a single buffer */
+struct mmsghdr {
+    void *msg_buf;
+    size_t msg_size;            // size of the buffer
+    ssize_t msg_len;            // bytes transferred, or negative error code
+};
+
 /* socket-specific I/O descriptor (see io.h) */
 typedef struct SocketDescriptor {
     Process *process;
@@ -62,11 +112,28 @@ typedef struct SocketDescriptor {
     lock_t lock;
     bool listener;
     int globalIndex;
+    uint32_t addressHash;               // hash of the bound address
+    bool hashed;                        // true if bound to a named address
+    struct SocketDescriptor *hashNext;
     int type, protocol, backlogMax, backlogCount;
+    int backlogHead;                    // oldest pending connection in the ring
+    lock_t backlogLock;                 // protects the backlog and acceptWaiting
+    SyscallRequest *acceptWaiting;      // accept() calls sleeping on the listener
+    SyscallRequest *sendWaiting;        // senders sleeping until this queue drains, under lock
+    struct SocketDescriptor *connecting;    // listener whose backlog holds this socket
     int inboundMax, outboundMax;        // buffer sizes
     int inboundCount, outboundCount;
+    int inboundHead, outboundHead;      // oldest message in the ring buffers
     void **inbound, **outbound;
     size_t *inboundLen, *outboundLen;
+    uint8_t *inboundInline;             // SOCKET_INLINE_SIZE bytes per queue slot
+    uint8_t *stream;                    // byte ring for SOCK_STREAM
+    size_t streamSize, streamHead, streamCount;
+    size_t inboundBytes;                // bytes queued in the message queue
+    size_t sndbuf, rcvbuf;              // limits, see setsockopt()
+    int rcvmsgs;
+    struct EpollItem *watchers;         // see poll.c
+    bool hangup;                        // peer closed the connection
     struct SocketDescriptor **backlog;  // for incoming connections via connect()
     struct SocketDescriptor *peer;      // for peer-to-peer connections
     int refCount;
@@ -74,6 +141,7 @@ typedef struct SocketDescriptor {
 
 void socketInit();
 SocketDescriptor *getLocalSocket(const struct sockaddr *, socklen_t);
+uint32_t socketHash(const char *);
 void socketLock();
 void socketRelease();
 int socketRegister(SocketDescriptor *);
@@ -84,7 +152,26 @@ int socket(Thread *, int, int, int);
 int connect(Thread *, int, const struct sockaddr *, socklen_t);
 int bind(Thread *, int, const struct sockaddr *, socklen_t);
 int listen(Thread *, int, int);
+int socketpair(Thread *, int, int, int, int *);
+bool socketAcceptWait(SyscallRequest *);
+void socketAcceptCancel(SyscallRequest *);
+void socketBacklogClose(SocketDescriptor *);
+int socketIODescriptor(Thread *, int, SocketDescriptor **);
+bool socketSendWait(SyscallRequest *, size_t);
+void socketSendCancel(SyscallRequest *);
+void socketWakeSenders(SocketDescriptor *);
 int accept(Thread *, int, struct sockaddr *, socklen_t *);
 ssize_t recv(Thread *, int, void *, size_t, int);
 ssize_t send(Thread *, int, const void *, size_t, int);
+int sendmmsg(Thread *, int, struct mmsghdr *, unsigned int, int);
+int recvmmsg(Thread *, int, struct mmsghdr *, unsigned int, int);
+int setsockopt(Thread *, int, int, int, const void *, socklen_t);
+int getsockopt(Thread *, int, int, int, void *, socklen_t *);
 int closeSocket(Thread *, int);
+int socketPoll(SocketDescriptor *);
+
+/* message buffers */
+void socketBufferInit();
+void *socketBufferAllocate(size_t);
+void socketBufferFree(void *, size_t);
+void socketQueueFlush(SocketDescriptor *);
@@ -11,12 +11,14 @@
 #include <stdbool.h>
 #include <kernel/sched.h>
 
-#define MAX_SYSCALL             66
+#define MAX_SYSCALL             76
 
 /* IPC syscall indexes, this range will be used for immediate handling without
  * waiting for the kernel thread to dispatch the syscall */
 #define SYSCALL_IPC_START       48      // bind()
 #define SYSCALL_IPC_END         52      // send()
+#define SYSCALL_MMSG_START      73      // sendmmsg()
+#define SYSCALL_MMSG_END        74      // recvmmsg()
 #define SYSCALL_RW_START        18      // read()
 #define SYSCALL_RW_END          19      // write()
 #define SYSCALL_LSEEK           22      // lseek()
@@ -25,11 +27,13 @@ typedef struct SyscallRequest {
     bool busy, queued, unblock;
     bool external;          // set for syscalls that are handled in user space
     bool retry;             // for async syscalls
+    bool waiting;           // sleeping on an object instead of in the queue
 
     uint16_t requestID;     // unique random ID for user space syscalls
     uint64_t function;
     uint64_t params[4];
     uint64_t ret;           // return value from the kernel to the program
+    uint64_t deadline;      // uptime at which a blocking wait times out, zero for never
 
     struct Thread *thread;
     struct SyscallRequest *next;
@@ -20,6 +20,7 @@ typedef struct {
     uint32_t fg, bg;
     uint32_t *fb;
     uint32_t *fbhw;
+    uintptr_t fbPhysical;   // physical address of the hardware frame buffer
     uint32_t pitch;
     char escape[256];
     bool escaping;
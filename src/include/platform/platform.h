@@ -24,15 +24,25 @@
 #define PLATFORM_PAGE_EXEC                  0x0008
 #define PLATFORM_PAGE_WRITE                 0x0010
 #define PLATFORM_PAGE_NO_CACHE              0x0020
+#define PLATFORM_PAGE_WRITE_COMBINE         0x0040      // for frame buffers
+#define PLATFORM_PAGE_WRITE_THROUGH         0x0080
+#define PLATFORM_PAGE_SHARED                0x0100      // owned by the kernel, not freed with the address space
 #define PLATFORM_PAGE_ERROR                 0x8000      // all bits invalid if this bit is set
 
 extern char *platformCPUModel;
 
 int platformCPUSetup();         // very early setup for one CPU
 int platformPagingSetup();      // paging setup for virtual memory management
+int platformCacheColors();      // number of page colors in the last-level cache
 uintptr_t platformGetPage(int *, uintptr_t);     // get physical address and flags of a page
 uintptr_t platformMapPage(uintptr_t, uintptr_t, int);    // map a physical address to a virtual address
 int platformUnmapPage(uintptr_t);               // and vice versa
+void *platformGetPageTable(uintptr_t, int *);   // lowest-level paging structure covering an address
+void *platformGetContextPageTable(void *, uintptr_t, int *);    // same as above in another address space
+uintptr_t platformGetPageEntry(void *, int, int *);     // decode an entry in such a structure
+void platformSetPageEntry(void *, int, uintptr_t, int); // and encode one
+bool platformReplacePageEntry(void *, int, uintptr_t, int, uintptr_t, int);   // atomically, if unchanged
+void platformInvalidatePage(void *, uintptr_t);     // flush a stale translation
 
 int platformRegisterCPU(void *);    // registers a CPU, relevant to multiprocessor systems
 int platformCountCPU();
@@ -64,6 +74,8 @@ int platformConfigureIRQ(Thread *, int, IRQHandler *);  // configure an IRQ pin
 IRQCommand *platformGetIRQCommand();    // per-CPU IRQ command structure
 void platformIdle();            // to be called when the CPU is idle
 void platformCleanThread(void *, uintptr_t);   // garbage collector after thread is killed or replaced by exec()
+uintptr_t platformDetachContext(void *);    // detach the address space of a context for reclaiming
+int platformReclaimSpace(uintptr_t, uintptr_t *, int);  // free part of a detached address space
 int platformSendSignal(Thread *, Thread *, int, uintptr_t);
 void platformSigreturn(Thread *);
 time_t platformTimestamp();         // unix timestamp
@@ -5,7 +5,7 @@
  * Core Microkernel
  */
 
-/* Abstractions for file systems and sockets */
+/* Abstractions for file systems, sockets, and pipes */
 
 #include <errno.h>
 #include <stdlib.h>
@@ -16,6 +16,8 @@
 #include <kernel/io.h>
 #include <kernel/socket.h>
 #include <kernel/file.h>
+#include <kernel/poll.h>
+#include <kernel/pipe.h>
 #include <kernel/logger.h>
 
 /* openIO(): opens an I/O descriptor in a process
@@ -28,18 +30,32 @@ int openIO(void *pv, void **iodv) {
     Process *p = (Process *)pv;
     IODescriptor **iod = (IODescriptor **)iodv;
 
-    if(p->iodCount >= MAX_IO_DESCRIPTORS) return -ESRCH;
+    if(p->iodCount >= MAX_IO_DESCRIPTORS) return -EMFILE;
 
-    /* find the first free descriptor */
-    int desc;
-    for(desc = 0; desc < MAX_IO_DESCRIPTORS; desc++) {
-        if(!p->io[desc].valid) break;
+    if(p->iodCount >= p->iodMax) {
+        // grow the descriptor table
+        int max = p->iodMax ? p->iodMax * 2 : IO_DESCRIPTORS_INITIAL;
+        if(max > MAX_IO_DESCRIPTORS) max = MAX_IO_DESCRIPTORS;
+
+        IODescriptor *table = realloc(p->io, max * sizeof(IODescriptor));
+        if(!table) return -ENOMEM;
+
+        memset(&table[p->iodMax], 0, (max - p->iodMax) * sizeof(IODescriptor));
+        p->io = table;
+        p->iodMax = max;
     }
 
-    if(desc >= MAX_IO_DESCRIPTORS) return -EMFILE;
+    /* find the first free descriptor using the bitmap; the table is always
+     * grown before it fills up so there is always a free slot here */
+    int word = __builtin_ctzll(~p->iodFull);
+    int desc = (word * 64) + __builtin_ctzll(~p->iodBitmap[word]);
+
+    p->iodBitmap[word] |= ((uint64_t)1 << (desc % 64));
+    if(p->iodBitmap[word] == ~(uint64_t)0) p->iodFull |= ((uint64_t)1 << word);
 
     p->io[desc].valid = true;
     p->io[desc].type = IO_WAITING;
+    p->io[desc].flags = 0;
     p->io[desc].data = NULL;
 
     p->iodCount++;
@@ -62,6 +78,9 @@ void closeIO(void *pv, void *iodv) {
         iod->valid = false;
         iod->data = NULL;
 
+        int desc = iod - p->io;
+        p->iodBitmap[desc / 64] &= ~((uint64_t)1 << (desc % 64));
+        p->iodFull &= ~((uint64_t)1 << (desc / 64));
         p->iodCount--;
     }
 }
@@ -83,10 +102,11 @@ ssize_t read(Thread *t, uint64_t id, int fd, void *buffer, size_t count) {
     else p = getProcess(getKernelPID());
     if(!p) return -ESRCH;
 
-    if(!p->io[fd].valid || !p->io[fd].data) return -EBADF;
+    if(fd >= p->iodMax || !p->io[fd].valid || !p->io[fd].data) return -EBADF;
 
     // relay the call to the appropriate file or socket handler
     if(p->io[fd].type == IO_SOCKET) return recv(t, fd, buffer, count, 0);
+    else if(p->io[fd].type == IO_PIPE) return pipeRead(t, fd, buffer, count);
     else if(p->io[fd].type == IO_FILE) return readFile(t, id, &p->io[fd], buffer, count);
     else return -EBADF;
 }
@@ -108,10 +128,11 @@ ssize_t write(Thread *t, uint64_t id, int fd, const void *buffer, size_t count)
     else p = getProcess(getKernelPID());
     if(!p) return -ESRCH;
 
-    if(!p->io[fd].valid || !p->io[fd].data) return -EBADF;
+    if(fd >= p->iodMax || !p->io[fd].valid || !p->io[fd].data) return -EBADF;
 
     // relay the call to the appropriate file or socket handler
     if(p->io[fd].type == IO_SOCKET) return send(t, fd, buffer, count, 0);
+    else if(p->io[fd].type == IO_PIPE) return pipeWrite(t, fd, buffer, count);
     else if(p->io[fd].type == IO_FILE) return writeFile(t, id, &p->io[fd], buffer, count);
     else return -EBADF;
 }
@@ -131,14 +152,16 @@ int close(Thread *t, uint64_t id, int fd) {
     else p = getProcess(getKernelPID());
     if(!p) return -ESRCH;
 
-    if(!p->io[fd].valid || !p->io[fd].data) return -EBADF;
+    if(fd >= p->iodMax || !p->io[fd].valid || !p->io[fd].data) return -EBADF;
 
     if(p->io[fd].type == IO_SOCKET) return closeSocket(t, fd);
     else if(p->io[fd].type == IO_FILE) return closeFile(t, id, fd);
+    else if(p->io[fd].type == IO_EPOLL) return closeEpoll(t, fd);
+    else if(p->io[fd].type == IO_PIPE) return closePipe(t, fd);
     else return -EBADF;
 }
 
-/* ioperm(): sets the I/O permissions for the current thread
+/* ioperm(): sets the I/O permissions for the current process
  * params: t - calling thread
  * params: from - base I/O port
  * params: count - number of I/O ports to change permissions
@@ -194,7 +217,7 @@ int ioctl(struct Thread *t, uint64_t id, int fd, unsigned long op, ...) {
     else p = getProcess(getKernelPID());
     if(!p) return -ESRCH;
 
-    if(!p->io[fd].valid || !p->io[fd].data) return -EBADF;
+    if(fd >= p->iodMax || !p->io[fd].valid || !p->io[fd].data) return -EBADF;
     if(p->io[fd].type != IO_FILE) return -EBADF;
 
     FileDescriptor *file = (FileDescriptor *) p->io[fd].data;
@@ -8,12 +8,18 @@
 /* Socket Connection Functions */
 /* connect(), listen(), and accept() are implemented here */
 
+/* the backlog of a listener is a ring of pending connections with its own
+ * lock, so that connect() and accept() only hold the global socket lock for
+ * a constant amount of work; blocking accept() calls sleep on the listener
+ * and are woken one at a time by connect() */
+
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <platform/lock.h>
 #include <kernel/logger.h>
 #include <kernel/socket.h>
+#include <kernel/poll.h>
 #include <kernel/io.h>
 #include <kernel/sched.h>
 
@@ -32,7 +38,7 @@ int connect(Thread *t, int sd, const struct sockaddr *addr, socklen_t len) {
     else p = getProcess(getKernelPID());
     if(!p) return -ESRCH;
 
-    if(!p->io[sd].valid || !p->io[sd].data || (p->io[sd].type != IO_SOCKET))
+    if(sd >= p->iodMax || !p->io[sd].valid || !p->io[sd].data || (p->io[sd].type != IO_SOCKET))
         return -ENOTSOCK;
 
     socketLock();
@@ -65,24 +71,40 @@ int connect(Thread *t, int sd, const struct sockaddr *addr, socklen_t len) {
         return -ECONNREFUSED;
     }
 
-    if(peer->backlogCount >= peer->backlogMax) {
+    acquireLockBlocking(&peer->backlogLock);
+
+    // make sure the connection is not already in the backlog
+    if(self->connecting) {
+        releaseLock(&peer->backlogLock);
         socketRelease();
-        return -ECONNREFUSED;
+        return -EINPROGRESS;
     }
 
-    // make sure the connection is not already in the backlog
-    for(int i = 0; peer->backlogCount && (i < peer->backlogCount); i++) {
-        SocketDescriptor *request = peer->backlog[i];
-        if(!memcmp(request->address.sa_data, self->address.sa_data, self->addressLength)) {
-            socketRelease();
-            return -EINPROGRESS;
-        }
+    if(peer->backlogCount >= peer->backlogMax) {
+        releaseLock(&peer->backlogLock);
+        socketRelease();
+        return -ECONNREFUSED;
     }
 
     // at this point we're sure it's safe to attempt a connection
-    peer->backlog[peer->backlogCount] = self;
+    int tail = (peer->backlogHead + peer->backlogCount) % peer->backlogMax;
+    peer->backlog[tail] = self;
     peer->backlogCount++;
+    self->connecting = peer;
+
+    // and wake the oldest accept() sleeping on the listener
+    SyscallRequest *waiter = peer->acceptWaiting;
+    if(waiter) {
+        peer->acceptWaiting = waiter->next;
+        waiter->waiting = false;
+        waiter->next = NULL;
+    }
+
+    releaseLock(&peer->backlogLock);
     socketRelease();
+
+    if(waiter) syscallEnqueue(waiter);
+    pollNotify(&peer->watchers);
     return -EWOULDBLOCK;
 }
 
@@ -100,12 +122,20 @@ int listen(Thread *t, int sd, int backlog) {
     else p = getProcess(getKernelPID());
     if(!p) return -ESRCH;
 
-    if(!p->io[sd].valid || !p->io[sd].data || (p->io[sd].type != IO_SOCKET))
+    if(sd >= p->iodMax || !p->io[sd].valid || !p->io[sd].data || (p->io[sd].type != IO_SOCKET))
         return -ENOTSOCK;
     
     socketLock();
     SocketDescriptor *sock = (SocketDescriptor *) p->io[sd].data;
+
+    // keep the connections that are already pending if listening again
+    if(sock->listener) {
+        socketRelease();
+        return 0;
+    }
+
     sock->backlogCount = 0;
+    sock->backlogHead = 0;
 
     if(backlog > 0) sock->backlogMax = backlog;
     else sock->backlogMax = SOCKET_DEFAULT_BACKLOG;
@@ -138,7 +168,7 @@ int accept(Thread *t, int sd, struct sockaddr *addr, socklen_t *len) {
     else p = getProcess(getKernelPID());
     if(!p) return -ESRCH;
 
-    if(!p->io[sd].valid || !p->io[sd].data || (p->io[sd].type != IO_SOCKET))
+    if(sd >= p->iodMax || !p->io[sd].valid || !p->io[sd].data || (p->io[sd].type != IO_SOCKET))
         return -ENOTSOCK;
 
     SocketDescriptor *listener = (SocketDescriptor *)p->io[sd].data;
@@ -146,50 +176,198 @@ int accept(Thread *t, int sd, struct sockaddr *addr, socklen_t *len) {
         return -EINVAL;         // socket is not listening
     }
 
+    // this is checked again with the backlog locked
     if(!listener->backlogCount) {
         return -EWOULDBLOCK;    // socket has no incoming queue
     }
 
-    socketLock();
+    // create a new connected socket before taking any locks
+    SocketDescriptor *self = calloc(1, sizeof(SocketDescriptor));
+    if(!self) return -ENOMEM;
 
-    // create a new connected socket
     IODescriptor *iod = NULL;
     int connectedSocket = openIO(p, (void **) &iod);
     if((connectedSocket < 0) || !iod) {
-        socketRelease();
+        free(self);
         return -EMFILE;
     }
 
     iod->type = IO_SOCKET;
     iod->flags = p->io[sd].flags;
-    iod->data = calloc(1, sizeof(SocketDescriptor));
-    if(!iod->data) {
-        socketRelease();
-        closeIO(p, iod);
-        return -ENOMEM;
-    }
+    iod->data = self;
 
     // copy the self address
-    SocketDescriptor *self = (SocketDescriptor *)iod->data;
     self->refCount = 1;
     memcpy(&self->address, &listener->address, sizeof(struct sockaddr));
     self->addressLength = listener->addressLength;
     self->type = listener->type;
     self->protocol = listener->protocol;
     self->process = listener->process;
+    self->sndbuf = listener->sndbuf;
+    self->rcvbuf = listener->rcvbuf;
+    self->rcvmsgs = listener->rcvmsgs;
 
-    // and assign the peer address
-    self->peer = listener->backlog[0];  // TODO: is this always FIFO?
-    self->peer->peer = self;
-    memmove(&listener->backlog[0], &listener->backlog[1], (listener->backlogMax - 1) * sizeof(SocketDescriptor *));
+    socketLock();
+
+    // register the connected socket so that closing it doesn't unregister
+    // whichever socket happens to be at index zero
+    self->globalIndex = socketRegister(self);
+    if(self->globalIndex < 0) {
+        int status = self->globalIndex;
+        socketRelease();
+        free(self);
+        closeIO(p, &p->io[connectedSocket]);
+        return status;
+    }
+
+    // take the oldest pending connection off the ring
+    acquireLockBlocking(&listener->backlogLock);
+    if(!listener->backlogCount) {
+        // another thread accepted it first
+        releaseLock(&listener->backlogLock);
+        socketUnregister(self->globalIndex);
+        socketRelease();
+        free(self);
+        closeIO(p, &p->io[connectedSocket]);
+        return -EWOULDBLOCK;
+    }
+
+    SocketDescriptor *peer = listener->backlog[listener->backlogHead];
+    listener->backlog[listener->backlogHead] = NULL;
+    listener->backlogHead = (listener->backlogHead + 1) % listener->backlogMax;
     listener->backlogCount--;
+    releaseLock(&listener->backlogLock);
+
+    // and assign the peer address
+    self->peer = peer;
+    peer->peer = self;
+    peer->connecting = NULL;
 
     // save the peer address if requested
     if(addr && len) {
         if(*len > sizeof(struct sockaddr)) *len = sizeof(struct sockaddr);
-        memcpy(addr, &self->peer->address, *len);
+        memcpy(addr, &peer->address, *len);
     }
 
     socketRelease();
+    pollNotify(&peer->watchers);        // the connecting socket can send now
     return connectedSocket;
 }
+
+/* socketAcceptWait(): puts a blocking accept() to sleep until a connection
+ * arrives on the listener, instead of retrying it from the syscall queue
+ * params: req - syscall request of accept()
+ * returns: true if the request is sleeping, false if it should be retried
+ */
+
+bool socketAcceptWait(SyscallRequest *req) {
+    Process *p = getProcess(req->thread->pid);
+    if(!p) return false;
+
+    int sd = req->params[0];
+    socketLock();
+    if(sd < 0 || sd >= p->iodMax || !p->io[sd].valid || !p->io[sd].data || (p->io[sd].type != IO_SOCKET)) {
+        socketRelease();
+        return false;
+    }
+
+    SocketDescriptor *listener = (SocketDescriptor *) p->io[sd].data;
+    acquireLockBlocking(&listener->backlogLock);
+
+    // a connection may have arrived since accept() checked
+    if(!listener->listener || listener->backlogCount) {
+        releaseLock(&listener->backlogLock);
+        socketRelease();
+        return false;
+    }
+
+    // wake sleepers in the order they went to sleep
+    req->waiting = true;
+    req->next = NULL;
+    SyscallRequest **link = &listener->acceptWaiting;
+    while(*link) link = &(*link)->next;
+    *link = req;
+
+    releaseLock(&listener->backlogLock);
+    socketRelease();
+    return true;
+}
+
+/* socketAcceptCancel(): wakes a sleeping accept() early, so that a signal
+ * sent to the thread can be handled
+ * params: req - syscall request of accept()
+ * returns: nothing
+ */
+
+void socketAcceptCancel(SyscallRequest *req) {
+    Process *p = getProcess(req->thread->pid);
+    if(!p) return;
+
+    int sd = req->params[0];
+    bool woken = false;
+
+    socketLock();
+    if(sd >= 0 && sd < p->iodMax && p->io[sd].valid && p->io[sd].data && (p->io[sd].type == IO_SOCKET)) {
+        SocketDescriptor *listener = (SocketDescriptor *) p->io[sd].data;
+        acquireLockBlocking(&listener->backlogLock);
+
+        SyscallRequest **link = &listener->acceptWaiting;
+        while(*link && (*link != req)) link = &(*link)->next;
+        if(*link && req->waiting) {
+            *link = req->next;
+            req->waiting = false;
+            req->next = NULL;
+            woken = true;
+        }
+
+        releaseLock(&listener->backlogLock);
+    }
+
+    socketRelease();
+    if(woken) syscallEnqueue(req);
+}
+
+/* socketBacklogClose(): detaches a socket that is being closed from the
+ * backlogs it is in, the socket lock must be held
+ * params: sock - socket being closed
+ * returns: nothing
+ */
+
+void socketBacklogClose(SocketDescriptor *sock) {
+    // a pending connection leaves its listener's backlog
+    SocketDescriptor *listener = sock->connecting;
+    if(listener) {
+        acquireLockBlocking(&listener->backlogLock);
+        int removed = 0;
+        for(int i = 0; i < listener->backlogCount; i++) {
+            int index = (listener->backlogHead + i) % listener->backlogMax;
+            if(listener->backlog[index] == sock) removed++;
+            else if(removed) listener->backlog[(index + listener->backlogMax - removed) % listener->backlogMax] = listener->backlog[index];
+        }
+
+        listener->backlogCount -= removed;
+        releaseLock(&listener->backlogLock);
+        sock->connecting = NULL;
+    }
+
+    if(!sock->listener) return;
+
+    // a listener drops its pending connections and wakes its sleepers, which
+    // will find the descriptor closed
+    acquireLockBlocking(&sock->backlogLock);
+    for(int i = 0; i < sock->backlogCount; i++)
+        sock->backlog[(sock->backlogHead + i) % sock->backlogMax]->connecting = NULL;
+    sock->backlogCount = 0;
+
+    SyscallRequest *waiter = sock->acceptWaiting;
+    sock->acceptWaiting = NULL;
+    releaseLock(&sock->backlogLock);
+
+    while(waiter) {
+        SyscallRequest *next = waiter->next;
+        waiter->waiting = false;
+        waiter->next = NULL;
+        syscallEnqueue(waiter);
+        waiter = next;
+    }
+}
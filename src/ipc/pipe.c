@@ -0,0 +1,298 @@
+/*
+ * lux - a lightweight unix-like operating system
+ * Omar Elghoul, 2024
+ *
+ * Core Microkernel
+ */
+
+/* Anonymous Pipes */
+/* pipe() and I/O on pipes are implemented here */
+
+/* a pipe is a byte ring of PIPE_PAGES physical pages that are accessed
+ * through the kernel's direct mapping, so that a pipe costs no virtual
+ * address space and only takes pages as data actually piles up in it; both
+ * ends are ordinary I/O descriptors, so they are inherited across fork() and
+ * exec() like any other descriptor without going through the socket table */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <kernel/pipe.h>
+#include <kernel/poll.h>
+#include <kernel/io.h>
+#include <kernel/memory.h>
+#include <kernel/sched.h>
+
+/* pipeDescriptor(): returns the pipe behind an I/O descriptor
+ * params: p - process
+ * params: fd - descriptor
+ * returns: pointer to the pipe, NULL if the descriptor is not a pipe
+ */
+
+static Pipe *pipeDescriptor(Process *p, int fd) {
+    if(fd < 0 || fd >= p->iodMax || !p->io[fd].valid || !p->io[fd].data || (p->io[fd].type != IO_PIPE))
+        return NULL;
+    return (Pipe *) p->io[fd].data;
+}
+
+/* pipeProcess(): returns the process of a calling thread
+ * params: t - calling thread, NULL for kernel threads
+ * returns: pointer to the process, NULL if it doesn't exist
+ */
+
+static Process *pipeProcess(Thread *t) {
+    if(t) return getProcess(t->pid);
+    return getProcess(getKernelPID());
+}
+
+/* pipeFree(): frees a pipe after both of its ends are closed
+ * params: pipe - pipe to free, must not be locked
+ * returns: nothing
+ */
+
+static void pipeFree(Pipe *pipe) {
+    pollDetach(&pipe->watchers);
+    for(int i = 0; i < PIPE_PAGES; i++) {
+        if(pipe->pages[i]) pmmFree(pipe->pages[i]);
+    }
+
+    free(pipe);
+}
+
+/* pipe(): creates a pipe
+ * params: t - calling thread, NULL for kernel threads
+ * params: fds - array of two descriptors to store the read and write ends in
+ * params: flags - O_NONBLOCK and O_CLOEXEC, applied to both ends
+ * returns: zero on success, negative error code on fail
+ */
+
+int pipe(Thread *t, int *fds, int flags) {
+    Process *p = pipeProcess(t);
+    if(!p) return -ESRCH;
+    if(p->iodCount > (MAX_IO_DESCRIPTORS - 2)) return -EMFILE;
+
+    Pipe *pipe = calloc(1, sizeof(Pipe));
+    if(!pipe) return -ENOMEM;
+
+    IODescriptor *reader = NULL, *writer = NULL;
+    int rfd = openIO(p, (void **) &reader);
+    if(rfd < 0) {
+        free(pipe);
+        return rfd;
+    }
+
+    reader->type = IO_PIPE;
+    int wfd = openIO(p, (void **) &writer);
+    if(wfd < 0) {
+        closeIO(p, &p->io[rfd]);
+        free(pipe);
+        return wfd;
+    }
+
+    // the table may have grown and moved while opening the write end
+    reader = &p->io[rfd];
+
+    flags &= (O_NONBLOCK | O_CLOEXEC);
+    reader->type = IO_PIPE;
+    reader->flags = flags | O_RDONLY;
+    reader->data = pipe;
+    writer->type = IO_PIPE;
+    writer->flags = flags | O_WRONLY;
+    writer->data = pipe;
+
+    pipe->readers = 1;
+    pipe->writers = 1;
+
+    fds[0] = rfd;
+    fds[1] = wfd;
+    return 0;
+}
+
+/* pipePoll(): returns the readiness of a pipe
+ * params: pipe - pipe
+ * returns: mask of POLL* events that would not block
+ *
+ * the read end of a pipe always has a reader and the write end always has a
+ * writer, so the same mask works for both ends
+ */
+
+int pipePoll(Pipe *pipe) {
+    int ready = 0;
+    if(pipe->count) ready |= POLLIN;
+    if(!pipe->writers) ready |= POLLHUP;
+    if(!pipe->readers) ready |= POLLERR;
+    else if(pipe->count < PIPE_SIZE) ready |= POLLOUT;
+    return ready;
+}
+
+/* pipeRead(): reads from a pipe
+ * params: t - calling thread, NULL for kernel threads
+ * params: fd - read end of the pipe
+ * params: buffer - buffer to read into
+ * params: len - maximum number of bytes to read
+ * returns: number of bytes read, zero at end of file, negative error code on fail
+ */
+
+ssize_t pipeRead(Thread *t, int fd, void *buffer, size_t len) {
+    Process *p = pipeProcess(t);
+    if(!p) return -ESRCH;
+    Pipe *pipe = pipeDescriptor(p, fd);
+    if(!pipe || !(p->io[fd].flags & O_RDONLY)) return -EBADF;
+    if(!len) return 0;
+
+    acquireLockBlocking(&pipe->lock);
+    if(!pipe->count) {
+        int writers = pipe->writers;
+        releaseLock(&pipe->lock);
+        return writers ? -EWOULDBLOCK : 0;
+    }
+
+    if(len > pipe->count) len = pipe->count;
+
+    // copy one page at a time out of the direct mapping
+    size_t copied = 0;
+    while(copied < len) {
+        size_t pos = pipe->head & (PIPE_SIZE - 1);
+        size_t offset = pos & (PAGE_SIZE - 1);
+        size_t chunk = PAGE_SIZE - offset;
+        if(chunk > (len - copied)) chunk = len - copied;
+
+        memcpy((void *)((uintptr_t) buffer + copied),
+            (const void *)(vmmMMIO(pipe->pages[pos / PAGE_SIZE], true) + offset), chunk);
+
+        pipe->head = (pipe->head + chunk) & (PIPE_SIZE - 1);
+        pipe->count -= chunk;
+        copied += chunk;
+    }
+
+    releaseLock(&pipe->lock);
+    pollNotify(&pipe->watchers);    // writers may be able to write again
+    return copied;
+}
+
+/* pipeWrite(): writes to a pipe
+ * params: t - calling thread, NULL for kernel threads
+ * params: fd - write end of the pipe
+ * params: buffer - buffer to write from
+ * params: len - number of bytes to write
+ * returns: number of bytes written, negative error code on fail
+ *
+ * writes of up to PIPE_BUF bytes are never split; larger writes take as
+ * much as fits and return the number of bytes written
+ */
+
+ssize_t pipeWrite(Thread *t, int fd, const void *buffer, size_t len) {
+    Process *p = pipeProcess(t);
+    if(!p) return -ESRCH;
+    Pipe *pipe = pipeDescriptor(p, fd);
+    if(!pipe || !(p->io[fd].flags & O_WRONLY)) return -EBADF;
+
+    acquireLockBlocking(&pipe->lock);
+    if(!pipe->readers) {
+        releaseLock(&pipe->lock);
+        return -EPIPE;
+    }
+
+    if(!len) {
+        releaseLock(&pipe->lock);
+        return 0;
+    }
+
+    size_t space = PIPE_SIZE - pipe->count;
+    if(!space || ((len <= PIPE_BUF) && (len > space))) {
+        releaseLock(&pipe->lock);
+        return -EWOULDBLOCK;
+    }
+
+    if(len > space) len = space;
+
+    size_t copied = 0;
+    while(copied < len) {
+        size_t pos = (pipe->head + pipe->count) & (PIPE_SIZE - 1);
+        size_t offset = pos & (PAGE_SIZE - 1);
+        size_t chunk = PAGE_SIZE - offset;
+        if(chunk > (len - copied)) chunk = len - copied;
+
+        // take pages only as the ring fills up
+        uintptr_t *page = &pipe->pages[pos / PAGE_SIZE];
+        if(!*page) {
+            *page = pmmAllocate();
+            if(!*page) break;
+        }
+
+        memcpy((void *)(vmmMMIO(*page, true) + offset),
+            (const void *)((uintptr_t) buffer + copied), chunk);
+
+        pipe->count += chunk;
+        copied += chunk;
+    }
+
+    releaseLock(&pipe->lock);
+    if(!copied) return -ENOMEM;
+
+    pollNotify(&pipe->watchers);    // readers have data now
+    return copied;
+}
+
+/* pipeShare(): counts another descriptor referring to an end of a pipe
+ * params: iod - new descriptor, as copied by fork() or fcntl()
+ * returns: nothing
+ */
+
+void pipeShare(IODescriptor *iod) {
+    Pipe *pipe = (Pipe *) iod->data;
+
+    acquireLockBlocking(&pipe->lock);
+    if(iod->flags & O_RDONLY) pipe->readers++;
+    else pipe->writers++;
+    releaseLock(&pipe->lock);
+}
+
+/* pipeClose(): closes one descriptor referring to an end of a pipe
+ * params: p - process
+ * params: fd - descriptor
+ * returns: nothing
+ */
+
+static void pipeClose(Process *p, int fd) {
+    Pipe *pipe = (Pipe *) p->io[fd].data;
+
+    acquireLockBlocking(&pipe->lock);
+    if(p->io[fd].flags & O_RDONLY) pipe->readers--;
+    else pipe->writers--;
+    bool unused = !pipe->readers && !pipe->writers;
+    releaseLock(&pipe->lock);
+
+    closeIO(p, &p->io[fd]);
+    p->io[fd].flags = 0;
+
+    // the other end sees end of file or a broken pipe now
+    if(unused) pipeFree(pipe);
+    else pollNotify(&pipe->watchers);
+}
+
+/* closePipe(): closes an end of a pipe
+ * params: t - calling thread, NULL for kernel threads
+ * params: fd - descriptor
+ * returns: 1 on success, negative error code on fail
+ */
+
+int closePipe(Thread *t, int fd) {
+    Process *p = pipeProcess(t);
+    if(!p) return -ESRCH;
+    if(!pipeDescriptor(p, fd)) return -EBADF;
+
+    pipeClose(p, fd);
+    return 1;
+}
+
+/* pipeRelease(): closes the pipe ends of a process that exited
+ * params: p - process
+ * returns: nothing
+ */
+
+void pipeRelease(Process *p) {
+    for(int i = 0; i < p->iodMax; i++) {
+        if(pipeDescriptor(p, i)) pipeClose(p, i);
+    }
+}
@@ -0,0 +1,415 @@
+/*
+ * lux - a lightweight unix-like operating system
+ * Omar Elghoul, 2024
+ *
+ * Core Microkernel
+ */
+
+/* Readiness Notification */
+/* poll() and the epoll family are implemented here */
+
+/* poll() checks every descriptor it is given, but an epoll interest set keeps
+ * a ready list that objects append to when their state changes, so waiting on
+ * it costs time proportional to the number of ready descriptors rather than
+ * the number of descriptors in the set; level-triggered items go back on the
+ * ready list after being reported and drop off once they are no longer ready,
+ * while edge-triggered items are only queued again by the next notification
+ *
+ * all interest sets and watcher lists are protected by a single lock, so that
+ * objects can notify and detach their watchers without any lock ordering
+ * concerns, and so that an object cannot be freed while a wait inspects it */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <platform/lock.h>
+#include <kernel/poll.h>
+#include <kernel/socket.h>
+#include <kernel/pipe.h>
+#include <kernel/io.h>
+#include <kernel/sched.h>
+
+static lock_t lock = LOCK_INITIAL;
+
+/* pollQueue(): appends an item to the ready list of its interest set
+ * params: item - item to queue, the poll lock must be held
+ * returns: nothing
+ */
+
+static void pollQueue(EpollItem *item) {
+    if(item->queued || !item->epoll) return;
+
+    Epoll *ep = item->epoll;
+    item->queued = true;
+    item->nextReady = NULL;
+    if(ep->readyTail) ep->readyTail->nextReady = item;
+    else ep->readyHead = item;
+    ep->readyTail = item;
+}
+
+/* pollUnqueue(): removes an item from the ready list of its interest set
+ * params: item - item to remove, the poll lock must be held
+ * returns: nothing
+ */
+
+static void pollUnqueue(EpollItem *item) {
+    if(!item->queued) return;
+
+    Epoll *ep = item->epoll;
+    EpollItem *prev = NULL;
+    EpollItem *current = ep->readyHead;
+    while(current && (current != item)) {
+        prev = current;
+        current = current->nextReady;
+    }
+
+    if(current) {
+        if(prev) prev->nextReady = item->nextReady;
+        else ep->readyHead = item->nextReady;
+        if(ep->readyTail == item) ep->readyTail = prev;
+    }
+
+    item->queued = false;
+    item->nextReady = NULL;
+}
+
+/* pollWatchers(): returns the list of watchers of an object
+ * params: type - type of I/O descriptor
+ * params: object - socket or pipe
+ * returns: pointer to the head of the list, NULL if the object can't be watched
+ */
+
+static EpollItem **pollWatchers(int type, void *object) {
+    if(type == IO_SOCKET) return &((SocketDescriptor *) object)->watchers;
+    else if(type == IO_PIPE) return &((Pipe *) object)->watchers;
+    return NULL;
+}
+
+/* pollObject(): returns the readiness of an object
+ * params: type - type of I/O descriptor
+ * params: object - file, socket, or pipe
+ * returns: mask of POLL* events that would not block
+ */
+
+static int pollObject(int type, void *object) {
+    switch(type) {
+    case IO_SOCKET:
+        return socketPoll((SocketDescriptor *) object);
+    case IO_PIPE:
+        return pipePoll((Pipe *) object);
+    case IO_EPOLL:
+        return ((Epoll *) object)->readyHead ? POLLIN : 0;
+    default:
+        // files and directories are relayed to their servers, and never block
+        return POLLIN | POLLOUT;
+    }
+}
+
+/* pollNotify(): queues the watchers of an object after its state changed
+ * params: watchers - pointer to the head of the object's list of watchers
+ * returns: nothing
+ */
+
+void pollNotify(EpollItem **watchers) {
+    if(!*watchers) return;
+
+    acquireLockBlocking(&lock);
+    for(EpollItem *item = *watchers; item; item = item->nextWatcher)
+        pollQueue(item);
+    releaseLock(&lock);
+}
+
+/* pollDetach(): removes all watchers of an object that is being closed
+ * params: watchers - pointer to the head of the object's list of watchers
+ * returns: nothing
+ */
+
+void pollDetach(EpollItem **watchers) {
+    acquireLockBlocking(&lock);
+
+    EpollItem *item = *watchers;
+    while(item) {
+        EpollItem *next = item->nextWatcher;
+        Epoll *ep = item->epoll;
+
+        pollUnqueue(item);
+        if(item->prev) item->prev->next = item->next;
+        else ep->items = item->next;
+        if(item->next) item->next->prev = item->prev;
+
+        free(item);
+        item = next;
+    }
+
+    *watchers = NULL;
+    releaseLock(&lock);
+}
+
+/* ioPoll(): returns the readiness of an I/O descriptor
+ * params: p - process
+ * params: fd - descriptor
+ * returns: mask of POLL* events that would not block, POLLNVAL if invalid
+ */
+
+int ioPoll(Process *p, int fd) {
+    if(fd < 0 || fd >= p->iodMax || !p->io[fd].valid || !p->io[fd].data) return POLLNVAL;
+    return pollObject(p->io[fd].type, p->io[fd].data);
+}
+
+/* poll(): checks the readiness of a set of descriptors
+ * params: t - calling thread
+ * params: fds - array of descriptors and requested events
+ * params: n - number of descriptors
+ * returns: number of ready descriptors, -EWOULDBLOCK if there are none
+ */
+
+int poll(Thread *t, struct pollfd *fds, nfds_t n) {
+    Process *p;
+    if(t) p = getProcess(t->pid);
+    else p = getProcess(getKernelPID());
+    if(!p) return -ESRCH;
+
+    int count = 0;
+    for(nfds_t i = 0; i < n; i++) {
+        if(fds[i].fd < 0) {
+            fds[i].revents = 0;
+            continue;
+        }
+
+        // errors and hangups are always reported
+        int ready = ioPoll(p, fds[i].fd);
+        fds[i].revents = ready & (fds[i].events | POLLERR | POLLHUP | POLLNVAL);
+        if(fds[i].revents) count++;
+    }
+
+    if(!count) return -EWOULDBLOCK;
+    return count;
+}
+
+/* epollDescriptor(): returns the interest set behind a descriptor
+ * params: p - process
+ * params: epfd - descriptor
+ * returns: pointer to the interest set, NULL if it isn't one
+ */
+
+static Epoll *epollDescriptor(Process *p, int epfd) {
+    if(epfd < 0 || epfd >= p->iodMax || !p->io[epfd].valid || !p->io[epfd].data || (p->io[epfd].type != IO_EPOLL))
+        return NULL;
+    return (Epoll *) p->io[epfd].data;
+}
+
+/* epoll_create(): creates an interest set
+ * params: t - calling thread, NULL for kernel threads
+ * params: flags - EPOLL_CLOEXEC
+ * returns: descriptor on success, negative error code on fail
+ */
+
+int epoll_create(Thread *t, int flags) {
+    Process *p;
+    if(t) p = getProcess(t->pid);
+    else p = getProcess(getKernelPID());
+    if(!p) return -ESRCH;
+
+    Epoll *ep = calloc(1, sizeof(Epoll));
+    if(!ep) return -ENOMEM;
+    ep->refCount = 1;
+
+    IODescriptor *iod = NULL;
+    int epfd = openIO(p, (void **) &iod);
+    if((epfd < 0) || !iod) {
+        free(ep);
+        return epfd;
+    }
+
+    iod->type = IO_EPOLL;
+    iod->data = ep;
+    iod->flags = (flags & EPOLL_CLOEXEC) ? O_CLOEXEC : 0;
+    return epfd;
+}
+
+/* epoll_ctl(): adds, modifies, or removes a descriptor in an interest set
+ * params: t - calling thread, NULL for kernel threads
+ * params: epfd - interest set
+ * params: op - EPOLL_CTL_ADD, EPOLL_CTL_MOD, or EPOLL_CTL_DEL
+ * params: fd - descriptor to watch
+ * params: event - requested events and user data, ignored for EPOLL_CTL_DEL
+ * returns: zero on success, negative error code on fail
+ */
+
+int epoll_ctl(Thread *t, int epfd, int op, int fd, struct epoll_event *event) {
+    Process *p;
+    if(t) p = getProcess(t->pid);
+    else p = getProcess(getKernelPID());
+    if(!p) return -ESRCH;
+
+    Epoll *ep = epollDescriptor(p, epfd);
+    if(!ep) return -EINVAL;
+    if(fd < 0 || fd >= p->iodMax || !p->io[fd].valid || !p->io[fd].data) return -EBADF;
+    if((op != EPOLL_CTL_DEL) && !event) return -EFAULT;
+
+    void *object = p->io[fd].data;
+    int type = p->io[fd].type;
+    EpollItem **watchers = pollWatchers(type, object);
+    if(!watchers) return -EPERM;       // regular files are always ready
+
+    acquireLockBlocking(&lock);
+
+    EpollItem *item = ep->items;
+    while(item && (item->object != object)) item = item->next;
+
+    switch(op) {
+    case EPOLL_CTL_ADD:
+        if(item) {
+            releaseLock(&lock);
+            return -EEXIST;
+        }
+
+        item = calloc(1, sizeof(EpollItem));
+        if(!item) {
+            releaseLock(&lock);
+            return -ENOMEM;
+        }
+
+        item->epoll = ep;
+        item->fd = fd;
+        item->type = type;
+        item->object = object;
+        item->events = event->events;
+        item->data = event->data;
+
+        item->next = ep->items;
+        if(ep->items) ep->items->prev = item;
+        ep->items = item;
+
+        item->nextWatcher = *watchers;
+        *watchers = item;
+
+        // report the current state once, even for edge-triggered items
+        pollQueue(item);
+        break;
+
+    case EPOLL_CTL_MOD:
+        if(!item) {
+            releaseLock(&lock);
+            return -ENOENT;
+        }
+
+        item->events = event->events;
+        item->data = event->data;
+        pollQueue(item);
+        break;
+
+    case EPOLL_CTL_DEL:
+        if(!item) {
+            releaseLock(&lock);
+            return -ENOENT;
+        }
+
+        pollUnqueue(item);
+        if(item->prev) item->prev->next = item->next;
+        else ep->items = item->next;
+        if(item->next) item->next->prev = item->prev;
+
+        EpollItem **link = watchers;
+        while(*link && (*link != item)) link = &(*link)->nextWatcher;
+        if(*link) *link = item->nextWatcher;
+
+        free(item);
+        break;
+
+    default:
+        releaseLock(&lock);
+        return -EINVAL;
+    }
+
+    releaseLock(&lock);
+    return 0;
+}
+
+/* epoll_wait(): returns the ready descriptors of an interest set
+ * params: t - calling thread, NULL for kernel threads
+ * params: epfd - interest set
+ * params: events - array to store events in
+ * params: max - maximum number of events
+ * returns: number of events, -EWOULDBLOCK if there are none
+ */
+
+int epoll_wait(Thread *t, int epfd, struct epoll_event *events, int max) {
+    Process *p;
+    if(t) p = getProcess(t->pid);
+    else p = getProcess(getKernelPID());
+    if(!p) return -ESRCH;
+
+    Epoll *ep = epollDescriptor(p, epfd);
+    if(!ep) return -EINVAL;
+    if(max <= 0) return -EINVAL;
+
+    acquireLockBlocking(&lock);
+
+    // only walk the items that were queued when we started, because
+    // level-triggered items are queued again at the tail
+    EpollItem *last = ep->readyTail;
+    int count = 0;
+    while(ep->readyHead && (count < max)) {
+        EpollItem *item = ep->readyHead;
+        ep->readyHead = item->nextReady;
+        if(!ep->readyHead) ep->readyTail = NULL;
+        item->queued = false;
+        item->nextReady = NULL;
+
+        // one-shot items are disabled until they are modified again
+        int ready = 0;
+        if(item->events) ready = pollObject(item->type, item->object) & (item->events | POLLERR | POLLHUP);
+        if(ready) {
+            events[count].events = ready;
+            events[count].data = item->data;
+            count++;
+
+            if(item->events & EPOLLONESHOT) item->events = 0;
+            else if(!(item->events & EPOLLET)) pollQueue(item);
+        }
+
+        if(item == last) break;
+    }
+
+    releaseLock(&lock);
+
+    if(!count) return -EWOULDBLOCK;
+    return count;
+}
+
+/* closeEpoll(): closes an interest set
+ * params: t - calling thread, NULL for kernel threads
+ * params: epfd - interest set
+ * returns: 1 on success, negative error code on fail
+ */
+
+int closeEpoll(Thread *t, int epfd) {
+    Process *p;
+    if(t) p = getProcess(t->pid);
+    else p = getProcess(getKernelPID());
+    if(!p) return -ESRCH;
+
+    Epoll *ep = epollDescriptor(p, epfd);
+    if(!ep) return -EBADF;
+
+    acquireLockBlocking(&lock);
+    ep->refCount--;
+    if(!ep->refCount) {
+        EpollItem *item = ep->items;
+        while(item) {
+            EpollItem *next = item->next;
+            EpollItem **link = pollWatchers(item->type, item->object);
+            while(*link && (*link != item)) link = &(*link)->nextWatcher;
+            if(*link) *link = item->nextWatcher;
+
+            free(item);
+            item = next;
+        }
+
+        free(ep);
+    }
+
+    releaseLock(&lock);
+    closeIO(p, &p->io[epfd]);
+    return 1;
+}
@@ -10,6 +10,7 @@
 #include <string.h>
 #include <kernel/signal.h>
 #include <kernel/sched.h>
+#include <kernel/socket.h>
 #include <kernel/logger.h>
 #include <platform/lock.h>
 #include <platform/mmap.h>
@@ -238,6 +239,12 @@ int kill(Thread *t, pid_t pid, int sig) {
         }
 
         releaseLock(&dest->lock);
+
+        // wake a thread sleeping in accept() or send() so it sees the signal
+        if(dest->syscall.waiting) {
+            socketAcceptCancel(&dest->syscall);
+            socketSendCancel(&dest->syscall);
+        }
     }
 
     return 0;
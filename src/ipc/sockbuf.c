@@ -0,0 +1,122 @@
+/*
+ * lux - a lightweight unix-like operating system
+ * Omar Elghoul, 2024
+ *
+ * Core Microkernel
+ */
+
+/* Socket Message Buffers */
+
+/* messages that are too large to be stored inline in a socket's queue are
+ * stored in buffers from here; the kernel heap is page-granular and maps a
+ * guard page with every allocation, so instead of freeing buffers after they
+ * are received, they are kept in per-CPU pools of a few size classes and
+ * handed out again to the next message of the same class */
+
+#include <stdlib.h>
+#include <kernel/memory.h>
+#include <kernel/socket.h>
+#include <kernel/logger.h>
+#include <platform/platform.h>
+#include <platform/lock.h>
+
+typedef struct SocketBufferPool {
+    lock_t lock;
+    void *free[SOCKET_POOL_CLASSES];    // singly linked through the buffers
+    int count[SOCKET_POOL_CLASSES];
+} SocketBufferPool;
+
+static SocketBufferPool *pools = NULL;
+static int poolCount = 0;
+
+/* socketBufferInit(): allocates the per-CPU buffer pools
+ * params: none
+ * returns: nothing
+ */
+
+void socketBufferInit() {
+    poolCount = platformCountCPU();
+    pools = calloc(poolCount, sizeof(SocketBufferPool));
+    if(!pools) {
+        KWARN("failed to allocate socket buffer pools\n");
+        poolCount = 0;
+    }
+}
+
+/* socketBufferClass(): returns the size class of a message buffer
+ * params: len - size of the message
+ * returns: size class, -1 if the message is too large to be pooled
+ */
+
+static int socketBufferClass(size_t len) {
+    for(int i = 0; i < SOCKET_POOL_CLASSES; i++) {
+        if(len <= SOCKET_POOL_SIZE(i)) return i;
+    }
+
+    return -1;
+}
+
+/* socketBufferPool(): returns the pool of the current CPU
+ * params: none
+ * returns: pointer to the pool, NULL if pools are not available
+ */
+
+static SocketBufferPool *socketBufferPool() {
+    if(!pools) return NULL;
+    int cpu = platformWhichCPU();
+    if(cpu < 0 || cpu >= poolCount) return NULL;
+    return &pools[cpu];
+}
+
+/* socketBufferAllocate(): allocates a buffer for a message
+ * params: len - size of the message
+ * returns: pointer to the buffer, NULL on fail
+ */
+
+void *socketBufferAllocate(size_t len) {
+    int class = socketBufferClass(len);
+    if(class < 0) return malloc(len);
+
+    SocketBufferPool *pool = socketBufferPool();
+    if(pool) {
+        acquireLockBlocking(&pool->lock);
+        void *buffer = pool->free[class];
+        if(buffer) {
+            pool->free[class] = *(void **) buffer;
+            pool->count[class]--;
+            releaseLock(&pool->lock);
+            return buffer;
+        }
+
+        releaseLock(&pool->lock);
+    }
+
+    // always allocate the full size of the class so the buffer can be reused
+    return malloc(SOCKET_POOL_SIZE(class));
+}
+
+/* socketBufferFree(): frees a message buffer
+ * params: buffer - pointer to the buffer
+ * params: len - size of the message as passed to socketBufferAllocate()
+ * returns: nothing
+ */
+
+void socketBufferFree(void *buffer, size_t len) {
+    int class = socketBufferClass(len);
+    SocketBufferPool *pool = socketBufferPool();
+    if(class < 0 || !pool) {
+        free(buffer);
+        return;
+    }
+
+    acquireLockBlocking(&pool->lock);
+    if(pool->count[class] < SOCKET_POOL_DEPTH) {
+        *(void **) buffer = pool->free[class];
+        pool->free[class] = buffer;
+        pool->count[class]++;
+        buffer = NULL;
+    }
+
+    releaseLock(&pool->lock);
+    if(buffer) free(buffer);
+}
@@ -16,13 +16,23 @@
 #include <platform/lock.h>
 #include <kernel/logger.h>
 #include <kernel/socket.h>
+#include <kernel/poll.h>
 #include <kernel/io.h>
 #include <kernel/sched.h>
 
-/* array of system-wide open sockets */
+/* array of system-wide open sockets, grown on demand up to MAX_SOCKETS, and
+ * a stack of the indexes that were freed so they can be reused in O(1) */
 static lock_t lock = LOCK_INITIAL;
 static SocketDescriptor **sockets;
 static int socketCount;
+static int socketMax;           // allocated size of the table
+static int socketHighest;       // indexes at and above this were never used
+static int *freeIndexes;
+static int freeCount;
+
+/* named sockets are also kept in a hash table keyed by their path, so that
+ * connecting to a server doesn't have to compare against every socket */
+static SocketDescriptor **hashTable;
 
 /* socketInit(): initializes the socket subsystem
  * params: none
@@ -30,13 +40,19 @@ static int socketCount;
  */
 
 void socketInit() {
-    sockets = calloc(sizeof(SocketDescriptor *), MAX_SOCKETS);
-    if(!sockets) {
+    sockets = calloc(sizeof(SocketDescriptor *), SOCKET_TABLE_INITIAL);
+    freeIndexes = calloc(sizeof(int), SOCKET_TABLE_INITIAL);
+    hashTable = calloc(sizeof(SocketDescriptor *), SOCKET_HASH_BUCKETS);
+    if(!sockets || !freeIndexes || !hashTable) {
         KERROR("failed to allocate memory for socket subsystem\n");
         while(1);
     }
 
     socketCount = 0;
+    socketMax = SOCKET_TABLE_INITIAL;
+    socketHighest = 0;
+    freeCount = 0;
+    socketBufferInit();
     KDEBUG("max %d sockets, %d per process\n", MAX_SOCKETS, MAX_IO_DESCRIPTORS);
 }
 
@@ -48,18 +64,70 @@ void socketInit() {
 
 SocketDescriptor *getLocalSocket(const struct sockaddr *addr, socklen_t len) {
     if(!socketCount) return NULL;
-    if(len > sizeof(struct sockaddr)) len = sizeof(struct sockaddr);
-    for(int i = 0; i < socketCount; i++) {
-        if((sockets[i]) && (sockets[i]->address.sa_family == AF_UNIX ||
-        sockets[i]->address.sa_family == AF_LOCAL) &&
-        !strcmp((char *)&sockets[i]->address.sa_data, addr->sa_data)) {
-            return sockets[i];
+
+    uint32_t hash = socketHash(addr->sa_data);
+    SocketDescriptor *sock = hashTable[hash & (SOCKET_HASH_BUCKETS-1)];
+    while(sock) {
+        if((sock->addressHash == hash) && (sock->address.sa_family == AF_UNIX ||
+        sock->address.sa_family == AF_LOCAL) &&
+        !strcmp(sock->address.sa_data, addr->sa_data)) {
+            return sock;
         }
+
+        sock = sock->hashNext;
     }
 
     return NULL;
 }
 
+/* socketHash(): hashes a socket path
+ * params: path - path of a local socket, at most the size of sa_data
+ * returns: 32-bit FNV-1a hash of the path
+ */
+
+uint32_t socketHash(const char *path) {
+    uint32_t hash = 0x811C9DC5;
+    for(int i = 0; (i < sizeof(((struct sockaddr *)0)->sa_data)) && path[i]; i++) {
+        hash ^= (uint8_t) path[i];
+        hash *= 0x01000193;
+    }
+
+    return hash;
+}
+
+/* socketHashInsert(): adds a bound socket to the hash table
+ * params: sock - socket descriptor
+ * returns: nothing
+ */
+
+static void socketHashInsert(SocketDescriptor *sock) {
+    sock->addressHash = socketHash(sock->address.sa_data);
+    sock->hashNext = NULL;
+    sock->hashed = true;
+
+    // append so that the first socket bound to a path keeps receiving
+    // connections, as with the old linear search
+    SocketDescriptor **link = &hashTable[sock->addressHash & (SOCKET_HASH_BUCKETS-1)];
+    while(*link) link = &(*link)->hashNext;
+    *link = sock;
+}
+
+/* socketHashRemove(): removes a socket from the hash table
+ * params: sock - socket descriptor
+ * returns: nothing
+ */
+
+static void socketHashRemove(SocketDescriptor *sock) {
+    if(!sock->hashed) return;
+
+    SocketDescriptor **link = &hashTable[sock->addressHash & (SOCKET_HASH_BUCKETS-1)];
+    while(*link && (*link != sock)) link = &(*link)->hashNext;
+    if(*link) *link = sock->hashNext;
+
+    sock->hashNext = NULL;
+    sock->hashed = false;
+}
+
 /* socketLock(): acquires the socket descriptor spinlock
  * params: none
  * returns: nothing
@@ -86,15 +154,34 @@ void socketRelease() {
 int socketRegister(SocketDescriptor *sock) {
     if(socketCount >= MAX_SOCKETS) return -ENFILE;
 
-    for(int i = 0; i < MAX_SOCKETS; i++) {
-        if(!sockets[i]) {
-            sockets[i] = sock;
-            socketCount++;
-            return i;
+    int index;
+    if(freeCount) {
+        index = freeIndexes[--freeCount];
+    } else {
+        if(socketHighest >= socketMax) {
+            // grow the table, the free index stack never holds more entries
+            // than the table so it grows along with it
+            int max = socketMax * 2;
+            if(max > MAX_SOCKETS) max = MAX_SOCKETS;
+
+            SocketDescriptor **newsockets = realloc(sockets, max * sizeof(SocketDescriptor *));
+            if(!newsockets) return -ENOMEM;
+            sockets = newsockets;
+
+            int *newfree = realloc(freeIndexes, max * sizeof(int));
+            if(!newfree) return -ENOMEM;
+            freeIndexes = newfree;
+
+            memset(&sockets[socketMax], 0, (max - socketMax) * sizeof(SocketDescriptor *));
+            socketMax = max;
         }
+
+        index = socketHighest++;
     }
 
-    return -ENFILE;
+    sockets[index] = sock;
+    socketCount++;
+    return index;
 }
 
 /* socketUnregister(): unregisters an open socket
@@ -103,18 +190,16 @@ int socketRegister(SocketDescriptor *sock) {
  */
 
 SocketDescriptor *socketUnregister(int index) {
-    if(!socketCount) return NULL;
+    if(!socketCount || (index < 0) || (index >= socketHighest)) return NULL;
 
-    for(int i = 0; i < MAX_SOCKETS; i++) {
-        SocketDescriptor *sd = sockets[i];
-        if(sd && (sd->globalIndex == index)) {
-            sockets[i] = NULL;
-            socketCount--;
-            return sd;
-        }
-    }
+    SocketDescriptor *sd = sockets[index];
+    if(!sd || (sd->globalIndex != index)) return NULL;
 
-    return NULL;
+    socketHashRemove(sd);
+    sockets[index] = NULL;
+    freeIndexes[freeCount++] = index;
+    socketCount--;
+    return sd;
 }
 
 /* socket(): opens a communication socket
@@ -138,7 +223,10 @@ int socket(Thread *t, int domain, int type, int protocol) {
 
     IODescriptor *iod = NULL;       // open I/O descriptor
     int sd = openIO(p, (void **) &iod);
-    if(sd < 0 || !iod) return sd;
+    if(sd < 0 || !iod) {
+        releaseLock(&lock);
+        return sd;
+    }
 
     iod->type = IO_SOCKET;
     iod->data = calloc(1, sizeof(SocketDescriptor));
@@ -156,12 +244,17 @@ int socket(Thread *t, int domain, int type, int protocol) {
     sock->address.sa_family = domain;
     sock->type = type & 0xFF;
     sock->protocol = protocol;
+    sock->sndbuf = SOCKET_DEFAULT_BUFFER;
+    sock->rcvbuf = SOCKET_DEFAULT_BUFFER;
+    sock->rcvmsgs = SOCKET_DEFAULT_MESSAGES;
     sock->globalIndex = socketRegister(sock);
 
     if(sock->globalIndex < 0) {
+        int status = sock->globalIndex;
+        free(sock);
         closeIO(p, iod);
         releaseLock(&lock);
-        return -ENFILE;
+        return status;
     }
 
     releaseLock(&lock);
@@ -185,7 +278,7 @@ int bind(Thread *t, int sd, const struct sockaddr *addr, socklen_t len) {
 
     // input verification
     if(len > sizeof(struct sockaddr)) len = sizeof(struct sockaddr);
-    if(!p->io[sd].valid || p->io[sd].type != IO_SOCKET) return -ENOTSOCK;
+    if(sd >= p->iodMax || !p->io[sd].valid || p->io[sd].type != IO_SOCKET) return -ENOTSOCK;
 
     acquireLockBlocking(&lock);
 
@@ -201,9 +294,52 @@ int bind(Thread *t, int sd, const struct sockaddr *addr, socklen_t len) {
     }
 
     // finally
+    socketHashRemove(sock);
     memcpy(&sock->address, addr, len);
     sock->addressLength = len;
+    socketHashInsert(sock);
+    releaseLock(&lock);
+    return 0;
+}
+
+/* socketpair(): creates a pair of connected sockets
+ * params: t - calling thread, NULL for kernel threads
+ * params: domain - socket domain, only AF_UNIX is supported
+ * params: type - socket type and flags, as in socket()
+ * params: protocol - socket protocol
+ * params: sv - array of two descriptors to store the sockets in
+ * returns: zero on success, negative error code on fail
+ *
+ * the sockets are connected to each other directly, without an address and
+ * without a listener or backlog
+ */
+
+int socketpair(Thread *t, int domain, int type, int protocol, int *sv) {
+    if(domain != AF_UNIX && domain != AF_LOCAL) return -EAFNOSUPPORT;
+
+    Process *p;
+    if(t) p = getProcess(t->pid);
+    else p = getProcess(getKernelPID());
+    if(!p) return -ESRCH;
+
+    int sd0 = socket(t, domain, type, protocol);
+    if(sd0 < 0) return sd0;
+
+    int sd1 = socket(t, domain, type, protocol);
+    if(sd1 < 0) {
+        closeSocket(t, sd0);
+        return sd1;
+    }
+
+    acquireLockBlocking(&lock);
+    SocketDescriptor *s0 = (SocketDescriptor *) p->io[sd0].data;
+    SocketDescriptor *s1 = (SocketDescriptor *) p->io[sd1].data;
+    s0->peer = s1;
+    s1->peer = s0;
     releaseLock(&lock);
+
+    sv[0] = sd0;
+    sv[1] = sd1;
     return 0;
 }
 
@@ -220,6 +356,8 @@ int closeSocket(Thread *t, int sd) {
     else p = getProcess(getKernelPID());
     if(!p) return -ESRCH;
 
+    if(sd >= p->iodMax) return -EBADF;
+
     acquireLockBlocking(&lock);
     SocketDescriptor *sock = (SocketDescriptor *) p->io[sd].data;
     if(!sock) {
@@ -227,8 +365,10 @@ int closeSocket(Thread *t, int sd) {
         return -EBADF;
     }
 
+    // other descriptors still refer to the socket, so only close this one
     sock->refCount--;
     if(sock->refCount) {
+        closeIO(p, &p->io[sd]);
         releaseLock(&lock);
         return 1;
     }
@@ -237,11 +377,21 @@ int closeSocket(Thread *t, int sd) {
         // disconnect the socket from its peer
         // TODO: for future TCP sockets, terminate the connection here
         sock->peer->peer = NULL;
+        sock->peer->hangup = true;
+        pollNotify(&sock->peer->watchers);
         sock->peer = NULL;
     }
 
-    // and delete the socket
+    socketBacklogClose(sock);
+    socketWakeSenders(sock);        // they will find the connection closed
+    pollDetach(&sock->watchers);
+
+    // and delete the socket along with any messages it never received
     socketUnregister(sock->globalIndex);
+    acquireLockBlocking(&sock->lock);
+    socketQueueFlush(sock);
+    releaseLock(&sock->lock);
+    if(sock->backlog) free(sock->backlog);
     free(sock);
     closeIO(p, &p->io[sd]);
     releaseLock(&lock);
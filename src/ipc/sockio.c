@@ -6,97 +6,601 @@
  */
 
 /* Socket I/O Functions */
-/* send() and recv() are implemented here */
+/* send(), recv(), and their batched forms are implemented here */
 
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <kernel/logger.h>
+#include <kernel/memory.h>
 #include <kernel/socket.h>
+#include <kernel/poll.h>
 #include <kernel/io.h>
 #include <kernel/sched.h>
 
-/* send(): sends a message to a socket connection
- * params: t - calling thread
- * params: sd - socket descriptor
- * params: buffer - buffer containing the message
+/* the inbound queue of a socket is a ring buffer whose size is always a power
+ * of two, so that messages can be queued and dequeued in constant time no
+ * matter how deep the backlog gets; every slot of the ring has room for a
+ * small message inline, and only larger messages need a separate buffer */
+
+/* large page-aligned messages sent with MSG_ZEROCOPY don't have a buffer at
+ * all; the physical pages are taken from the sender and queued as they are,
+ * and they are mapped straight into the receiver's buffer if it is suitably
+ * aligned, or copied out of the direct mapping otherwise */
+
+typedef struct SocketPages {
+    size_t count;
+    uintptr_t pages[];
+} SocketPages;
+
+/* socketInline(): checks whether a queued message is stored inline
+ * params: sock - socket descriptor
+ * params: message - pointer to the message
+ * returns: true if the message is in the socket's inline slots
+ */
+
+static inline bool socketInline(SocketDescriptor *sock, void *message) {
+    uintptr_t base = (uintptr_t) sock->inboundInline;
+    uintptr_t ptr = (uintptr_t) message;
+    return (ptr >= base) && (ptr < (base + (sock->inboundMax * SOCKET_INLINE_SIZE)));
+}
+
+/* socketQueueGrow(): doubles the size of a socket's inbound queue
+ * params: sock - socket descriptor, must be locked
+ * returns: zero on success, negative error code on fail
+ */
+
+static int socketQueueGrow(SocketDescriptor *sock) {
+    int max = sock->inboundMax ? sock->inboundMax * 2 : SOCKET_IO_BACKLOG;
+    void **newlist = malloc(max * sizeof(void *));
+    size_t *newlen = malloc(max * sizeof(size_t));
+    uint8_t *newinline = malloc(max * SOCKET_INLINE_SIZE);
+    if(!newlist || !newlen || !newinline) {
+        if(newlist) free(newlist);
+        if(newlen) free(newlen);
+        if(newinline) free(newinline);
+        return -ENOMEM;
+    }
+
+    // unwrap the old ring so the oldest message is at the start of the new
+    // one, moving inline messages along with their slots
+    for(int i = 0; i < sock->inboundCount; i++) {
+        int old = (sock->inboundHead + i) & (sock->inboundMax - 1);
+        newlen[i] = sock->inboundLen[old];
+
+        if(socketInline(sock, sock->inbound[old])) {
+            newlist[i] = &newinline[i * SOCKET_INLINE_SIZE];
+            memcpy(newlist[i], sock->inbound[old], newlen[i]);
+        } else {
+            newlist[i] = sock->inbound[old];
+        }
+    }
+
+    if(sock->inbound) free(sock->inbound);
+    if(sock->inboundLen) free(sock->inboundLen);
+    if(sock->inboundInline) free(sock->inboundInline);
+
+    sock->inbound = newlist;
+    sock->inboundLen = newlen;
+    sock->inboundInline = newinline;
+    sock->inboundMax = max;
+    sock->inboundHead = 0;
+    return 0;
+}
+
+/* socketFull(): checks whether a message fits in the limits of a socket
+ * params: self - sending socket
+ * params: peer - receiving socket, must be locked
  * params: len - size of the message
- * params: flags - optional flags for the request
- * returns: positive number of bytes sent, negative error code on fail
+ * returns: true if the sender must wait for the peer to receive
  */
 
-ssize_t send(Thread *t, int sd, const void *buffer, size_t len, int flags) {
+static bool socketFull(SocketDescriptor *self, SocketDescriptor *peer, size_t len) {
+    size_t queued;
+    if(peer->type == SOCK_STREAM) {
+        queued = peer->streamCount;
+    } else {
+        if(peer->inboundCount >= peer->rcvmsgs) return true;
+        queued = peer->inboundBytes;
+    }
+
+    if(!queued) return false;       // always accept one message into an empty queue
+
+    size_t limit = peer->rcvbuf;
+    if(self->sndbuf < limit) limit = self->sndbuf;
+    return (queued + len) > limit;
+}
+
+/* socketPoll(): returns the readiness of a socket
+ * params: sock - socket descriptor
+ * returns: mask of POLL* events that would not block
+ */
+
+int socketPoll(SocketDescriptor *sock) {
+    if(sock->listener) return sock->backlogCount ? POLLIN : 0;
+
+    int ready = 0;
+    if(sock->inboundCount || sock->streamCount) ready |= POLLIN;
+    if(sock->hangup) ready |= POLLHUP;
+
+    SocketDescriptor *peer = sock->peer;
+    if(peer && !socketFull(sock, peer, 1)) ready |= POLLOUT;
+    return ready;
+}
+
+/* socketStreamWrite(): appends data to the byte stream of a stream socket
+ * params: sock - receiving socket descriptor, must be locked
+ * params: buffer - data to append
+ * params: len - number of bytes
+ * returns: number of bytes written, negative error code on fail
+ */
+
+static ssize_t socketStreamWrite(SocketDescriptor *sock, const void *buffer, size_t len) {
+    if((sock->streamCount + len) > sock->streamSize) {
+        // grow the ring and unwrap it so that the stream starts at zero
+        size_t size = sock->streamSize ? sock->streamSize : SOCKET_STREAM_INITIAL;
+        while(size < (sock->streamCount + len)) size *= 2;
+
+        uint8_t *stream = malloc(size);
+        if(!stream) return -ENOBUFS;
+
+        if(sock->streamCount) {
+            size_t first = sock->streamSize - sock->streamHead;
+            if(first > sock->streamCount) first = sock->streamCount;
+            memcpy(stream, &sock->stream[sock->streamHead], first);
+            memcpy(&stream[first], sock->stream, sock->streamCount - first);
+        }
+
+        if(sock->stream) free(sock->stream);
+        sock->stream = stream;
+        sock->streamSize = size;
+        sock->streamHead = 0;
+    }
+
+    size_t tail = (sock->streamHead + sock->streamCount) & (sock->streamSize - 1);
+    size_t first = sock->streamSize - tail;
+    if(first > len) first = len;
+
+    memcpy(&sock->stream[tail], buffer, first);
+    memcpy(sock->stream, (const void *)((uintptr_t) buffer + first), len - first);
+    sock->streamCount += len;
+    return len;
+}
+
+/* socketStreamRead(): reads data from the byte stream of a stream socket,
+ * leaving whatever doesn't fit in the buffer for the next read
+ * params: sock - socket descriptor, must be locked
+ * params: buffer - buffer to read into
+ * params: len - maximum number of bytes
+ * params: flags - MSG_PEEK to leave the data in the stream
+ * returns: number of bytes read
+ */
+
+static ssize_t socketStreamRead(SocketDescriptor *sock, void *buffer, size_t len, int flags) {
+    if(len > sock->streamCount) len = sock->streamCount;
+
+    size_t first = sock->streamSize - sock->streamHead;
+    if(first > len) first = len;
+
+    memcpy(buffer, &sock->stream[sock->streamHead], first);
+    memcpy((void *)((uintptr_t) buffer + first), sock->stream, len - first);
+
+    if(!(flags & MSG_PEEK)) {
+        sock->streamCount -= len;
+        if(sock->streamCount) sock->streamHead = (sock->streamHead + len) & (sock->streamSize - 1);
+        else sock->streamHead = 0;
+    }
+
+    return len;
+}
+
+/* socketMessageFree(): frees the storage of a message removed from a queue
+ * params: sock - socket descriptor the message was queued on
+ * params: message - pointer to the message
+ * params: len - queued length of the message
+ * returns: nothing
+ */
+
+static void socketMessageFree(SocketDescriptor *sock, void *message, size_t len) {
+    if(len & SOCKET_MESSAGE_PAGES) {
+        SocketPages *sp = (SocketPages *) message;
+        pmmFreeBatch(sp->pages, sp->count);
+        free(sp);
+    } else if(!socketInline(sock, message)) {
+        socketBufferFree(message, len);
+    }
+}
+
+/* socketCopyPages(): copies a message that is queued as physical pages
+ * params: buffer - destination buffer
+ * params: sp - pages of the message
+ * params: len - number of bytes to copy
+ * returns: nothing
+ */
+
+static void socketCopyPages(void *buffer, SocketPages *sp, size_t len) {
+    for(size_t i = 0; (i < sp->count) && len; i++) {
+        size_t chunk = (len > PAGE_SIZE) ? PAGE_SIZE : len;
+        memcpy((void *)((uintptr_t) buffer + (i * PAGE_SIZE)), (const void *) vmmMMIO(sp->pages[i], true), chunk);
+        len -= chunk;
+    }
+}
+
+/* socketQueueFlush(): discards all queued messages and frees a socket's queue
+ * params: sock - socket descriptor, must be locked
+ * returns: nothing
+ */
+
+void socketQueueFlush(SocketDescriptor *sock) {
+    for(int i = 0; i < sock->inboundCount; i++) {
+        int index = (sock->inboundHead + i) & (sock->inboundMax - 1);
+        socketMessageFree(sock, sock->inbound[index], sock->inboundLen[index]);
+    }
+
+    if(sock->inbound) free(sock->inbound);
+    if(sock->inboundLen) free(sock->inboundLen);
+    if(sock->inboundInline) free(sock->inboundInline);
+    if(sock->stream) free(sock->stream);
+
+    sock->stream = NULL;
+    sock->streamSize = 0;
+    sock->streamHead = 0;
+    sock->streamCount = 0;
+    sock->inbound = NULL;
+    sock->inboundLen = NULL;
+    sock->inboundInline = NULL;
+    sock->inboundMax = 0;
+    sock->inboundCount = 0;
+    sock->inboundHead = 0;
+    sock->inboundBytes = 0;
+}
+
+/* socketIODescriptor(): returns the socket behind a socket descriptor
+ * params: t - calling thread, NULL for kernel threads
+ * params: sd - socket descriptor
+ * params: sock - pointer to store the socket
+ * returns: zero on success, negative error code on fail
+ */
+
+int socketIODescriptor(Thread *t, int sd, SocketDescriptor **sock) {
     if(sd < 0 || sd >= MAX_IO_DESCRIPTORS) return -EBADF;
     Process *p;
     if(t) p = getProcess(t->pid);
     else p = getProcess(getKernelPID());
     if(!p) return -ESRCH;
 
-    if(!p->io[sd].valid || !p->io[sd].data || (p->io[sd].type != IO_SOCKET))
+    if(sd >= p->iodMax || !p->io[sd].valid || !p->io[sd].data || (p->io[sd].type != IO_SOCKET))
         return -ENOTSOCK;
 
-    SocketDescriptor *self = (SocketDescriptor*) p->io[sd].data;
-    SocketDescriptor *peer = self->peer;
-    if(!peer) return -EDESTADDRREQ;     // not in connection mode
-
-    acquireLockBlocking(&peer->lock);
+    *sock = (SocketDescriptor *) p->io[sd].data;
+    return 0;
+}
 
-    sa_family_t family = self->address.sa_family;
+/* socketMessagePrepare(): stores a message outside of the peer's queue
+ * params: t - calling thread, NULL for kernel threads
+ * params: buffer - buffer containing the message
+ * params: len - size of the message
+ * params: flags - optional flags for the request
+ * params: message - pointer to store the message, NULL if it will be inline
+ * params: queued - pointer to store the queued length of the message
+ * returns: zero on success, -ENOBUFS on fail
+ *
+ * this does the copying of large messages before the peer is locked
+ */
 
-    if(family == AF_UNIX || family == AF_LOCAL) {
-        if(!peer->inbound || !peer->inboundLen || !peer->inboundMax) {
-            // ensure that the peer's inbound list exists at all
-            peer->inbound = calloc(SOCKET_IO_BACKLOG, sizeof(void *));
-            peer->inboundLen = calloc(SOCKET_IO_BACKLOG, sizeof(size_t));
+static int socketMessagePrepare(Thread *t, const void *buffer, size_t len, int flags,
+                                void **message, size_t *queued) {
+    *message = NULL;
+    *queued = len;
 
-            if(!peer->inbound || !peer->inboundLen) {
-                releaseLock(&peer->lock);
-                return -ENOMEM;
+    if((flags & MSG_ZEROCOPY) && t && (len >= SOCKET_ZEROCOPY_MIN) &&
+    !(((uintptr_t) buffer | len) & (PAGE_SIZE-1))) {
+        SocketPages *sp = malloc(sizeof(SocketPages) + ((len / PAGE_SIZE) * sizeof(uintptr_t)));
+        if(sp) {
+            sp->count = len / PAGE_SIZE;
+            if(!userDetachPages(t, (uintptr_t) buffer, sp->count, sp->pages)) {
+                *message = sp;
+                *queued = len | SOCKET_MESSAGE_PAGES;
+                return 0;
             }
 
-            peer->inboundMax = SOCKET_IO_BACKLOG;
-            peer->inboundCount = 0;
+            free(sp);
         }
+    }
 
-        if(peer->inboundCount >= peer->inboundMax) {
-            // reallocate the backlog if necessary
-            void **newlist = realloc(peer->inbound, peer->inboundMax * 2 * sizeof(void *));
-            if(!newlist) {
-                releaseLock(&peer->lock);
-                return -ENOMEM;
-            }
+    if(len > SOCKET_INLINE_SIZE) {
+        *message = socketBufferAllocate(len);
+        if(!*message) return -ENOBUFS;
+        memcpy(*message, buffer, len);
+    }
 
-            peer->inbound = newlist;
+    return 0;
+}
 
-            size_t *newlen = realloc(peer->inboundLen, peer->inboundMax * 2 * sizeof(size_t));
-            if(!newlen) {
-                releaseLock(&peer->lock);
-                return -ENOMEM;
-            }
+/* socketMessageCancel(): releases a prepared message that wasn't queued
+ * params: t - calling thread, NULL for kernel threads
+ * params: buffer - buffer containing the message
+ * params: len - size of the message
+ * params: message - message returned by socketMessagePrepare()
+ * params: queued - queued length returned by socketMessagePrepare()
+ * returns: nothing
+ */
 
-            peer->inboundLen = newlen;
-            peer->inboundMax *= 2;
+static void socketMessageCancel(Thread *t, const void *buffer, size_t len, void *message, size_t queued) {
+    if(queued & SOCKET_MESSAGE_PAGES) {
+        // give the pages back to the sender, or their contents if another
+        // thread was started in the meantime
+        SocketPages *sp = (SocketPages *) message;
+        if(userAttachPages(t, (uintptr_t) buffer, sp->count, sp->pages)) {
+            socketCopyPages((void *) buffer, sp, len);
+            pmmFreeBatch(sp->pages, sp->count);
         }
 
-        void *message = malloc(len);
-        if(!message) {
-            releaseLock(&peer->lock);
-            return -ENOBUFS;
-        }
+        free(sp);
+    } else if(message) {
+        socketBufferFree(message, len);
+    }
+}
+
+/* socketMessageQueue(): appends a prepared message to a peer's queue
+ * params: t - calling thread, NULL for kernel threads
+ * params: self - sending socket
+ * params: peer - receiving socket, must be locked
+ * params: buffer - buffer containing the message
+ * params: len - size of the message
+ * params: message - message returned by socketMessagePrepare()
+ * params: queued - queued length returned by socketMessagePrepare()
+ * returns: number of bytes sent, negative error code on fail
+ */
+
+static ssize_t socketMessageQueue(Thread *t, SocketDescriptor *self, SocketDescriptor *peer,
+                                  const void *buffer, size_t len, void *message, size_t queued) {
+    // wait for the peer to catch up if it's over its limits, or create the
+    // peer's inbound queue or grow it if it's full
+    if(t && socketFull(self, peer, len)) return -EWOULDBLOCK;
+    if((peer->inboundCount >= peer->inboundMax) && socketQueueGrow(peer)) return -ENOMEM;
 
-        // and send
+    int tail = (peer->inboundHead + peer->inboundCount) & (peer->inboundMax - 1);
+    if(!message) {
+        message = &peer->inboundInline[tail * SOCKET_INLINE_SIZE];
         memcpy(message, buffer, len);
-        peer->inbound[peer->inboundCount] = message;
-        peer->inboundLen[peer->inboundCount] = len;
-        peer->inboundCount++;
+    }
 
-        releaseLock(&peer->lock);
-        return len;
+    peer->inbound[tail] = message;
+    peer->inboundLen[tail] = queued;
+    peer->inboundCount++;
+    peer->inboundBytes += len;
+    return len;
+}
+
+/* socketStreamSend(): appends data to a peer's stream
+ * params: t - calling thread, NULL for kernel threads
+ * params: self - sending socket
+ * params: peer - receiving socket, must be locked
+ * params: buffer - buffer containing the data
+ * params: len - number of bytes
+ * returns: number of bytes sent, negative error code on fail
+ */
+
+static ssize_t socketStreamSend(Thread *t, SocketDescriptor *self, SocketDescriptor *peer,
+                                const void *buffer, size_t len) {
+    if(t && socketFull(self, peer, len)) return -EWOULDBLOCK;
+    return socketStreamWrite(peer, buffer, len);
+}
+
+/* socketReceive(): removes the next message from a socket's queue
+ * params: t - calling thread, NULL for kernel threads
+ * params: self - socket descriptor, must be locked
+ * params: buffer - buffer to store message
+ * params: len - maximum size of the buffer
+ * params: flags - optional flags for the request
+ * returns: number of bytes received, negative error code on fail
+ */
+
+static ssize_t socketReceive(Thread *t, SocketDescriptor *self, void *buffer, size_t len, int flags) {
+    if(self->type == SOCK_STREAM) {
+        // partial reads leave the rest of the stream queued, and MSG_WAITALL
+        // waits until the whole buffer can be filled, or until nothing more
+        // can arrive because the peer is gone or the stream is at its limit
+        if(!self->streamCount) return self->hangup ? 0 : -EWOULDBLOCK;
+        if((flags & MSG_WAITALL) && (self->streamCount < len) && !self->hangup &&
+        self->peer && !socketFull(self->peer, self, 1))
+            return -EWOULDBLOCK;
+
+        return socketStreamRead(self, buffer, len, flags);
+    }
+
+    // no messages available, or the end of a closed connection
+    if(!self->inboundCount || !self->inbound || !self->inboundLen)
+        return self->hangup ? 0 : -EWOULDBLOCK;
+
+    // copy from the inbound list
+    void *message = self->inbound[self->inboundHead];   // FIFO
+    size_t queued = self->inboundLen[self->inboundHead];
+    size_t truelen = SOCKET_MESSAGE_LENGTH(queued);
+    if(!message) return -EWOULDBLOCK;
+
+    if(queued & SOCKET_MESSAGE_PAGES) {
+        // move the pages into the receiver's buffer if the whole message
+        // fits, and fall back to copying them otherwise
+        SocketPages *sp = (SocketPages *) message;
+        if(t && !(flags & MSG_PEEK) && (truelen <= len) &&
+        !userAttachPages(t, (uintptr_t) buffer, sp->count, sp->pages)) {
+            free(sp);
+            message = NULL;
+        } else {
+            if(truelen > len) truelen = len;
+            socketCopyPages(buffer, sp, truelen);
+        }
     } else {
+        if(truelen > len) truelen = len;    // truncate longer messages
+        memcpy(buffer, message, truelen);
+    }
+
+    // remove the received message from the queue if we're in non-peek mode
+    if(!(flags & MSG_PEEK)) {
+        if(message) socketMessageFree(self, message, queued);
+
+        self->inbound[self->inboundHead] = NULL;
+        self->inboundHead = (self->inboundHead + 1) & (self->inboundMax - 1);
+        self->inboundCount--;
+        self->inboundBytes -= SOCKET_MESSAGE_LENGTH(queued);
+    }
+
+    return truelen;
+}
+
+/* send(): sends a message to a socket connection
+ * params: t - calling thread
+ * params: sd - socket descriptor
+ * params: buffer - buffer containing the message
+ * params: len - size of the message
+ * params: flags - optional flags for the request
+ * returns: positive number of bytes sent, negative error code on fail
+ *
+ * with MSG_ZEROCOPY, a page-aligned buffer of at least SOCKET_ZEROCOPY_MIN
+ * bytes is moved to the receiver rather than copied, and reads as zeroes
+ * after the call; other buffers are copied as usual
+ *
+ * user threads get -EWOULDBLOCK while the peer's queue is over the limits
+ * set with SO_SNDBUF, SO_RCVBUF and SO_RCVMSGS, and blocking sends then
+ * sleep in socketSendWait() until recv() makes room; the kernel never waits
+ */
+
+ssize_t send(Thread *t, int sd, const void *buffer, size_t len, int flags) {
+    SocketDescriptor *self;
+    int status = socketIODescriptor(t, sd, &self);
+    if(status) return status;
+
+    SocketDescriptor *peer = self->peer;
+    if(!peer) return -EDESTADDRREQ;     // not in connection mode
+
+    sa_family_t family = self->address.sa_family;
+    if(family != AF_UNIX && family != AF_LOCAL) {
         /* TODO: handle other protocols in user space */
-        releaseLock(&peer->lock);
         return -ENOTCONN;
     }
+
+    ssize_t sent;
+    if(peer->type == SOCK_STREAM) {
+        // stream sockets don't keep message boundaries
+        acquireLockBlocking(&peer->lock);
+        sent = socketStreamSend(t, self, peer, buffer, len);
+        releaseLock(&peer->lock);
+    } else {
+        // check the limits before doing any work, this is only a hint because
+        // the peer isn't locked yet and it is checked again when queueing
+        if(t && socketFull(self, peer, len)) return -EWOULDBLOCK;
+
+        void *message;
+        size_t queued;
+        status = socketMessagePrepare(t, buffer, len, flags, &message, &queued);
+        if(status) return status;
+
+        acquireLockBlocking(&peer->lock);
+        sent = socketMessageQueue(t, self, peer, buffer, len, message, queued);
+        releaseLock(&peer->lock);
+
+        if(sent < 0) socketMessageCancel(t, buffer, len, message, queued);
+    }
+
+    if(sent >= 0) pollNotify(&peer->watchers);
+    return sent;
+}
+
+/* socketSendWait(): puts a blocking send to sleep until the peer's queue
+ * has room for the message
+ * params: req - syscall request of the send, with the descriptor in params[0]
+ * params: len - size of the message that didn't fit
+ * returns: true if the request is sleeping, false if it should be retried
+ */
+
+bool socketSendWait(SyscallRequest *req, size_t len) {
+    SocketDescriptor *self;
+    if(socketIODescriptor(req->thread, req->params[0], &self)) return false;
+
+    // the socket lock keeps the peer from being closed under us
+    socketLock();
+    SocketDescriptor *peer = self->peer;
+    if(!peer) {
+        socketRelease();
+        return false;
+    }
+
+    acquireLockBlocking(&peer->lock);
+
+    // the receiver may have made room since the send was attempted
+    if(!socketFull(self, peer, len)) {
+        releaseLock(&peer->lock);
+        socketRelease();
+        return false;
+    }
+
+    // wake sleepers in the order they went to sleep
+    req->waiting = true;
+    req->next = NULL;
+    SyscallRequest **link = &peer->sendWaiting;
+    while(*link) link = &(*link)->next;
+    *link = req;
+
+    releaseLock(&peer->lock);
+    socketRelease();
+    return true;
+}
+
+/* socketSendCancel(): wakes a sleeping send early, so that a signal sent to
+ * the thread can be handled
+ * params: req - syscall request of the send
+ * returns: nothing
+ */
+
+void socketSendCancel(SyscallRequest *req) {
+    SocketDescriptor *self;
+    if(socketIODescriptor(req->thread, req->params[0], &self)) return;
+
+    bool woken = false;
+    socketLock();
+    SocketDescriptor *peer = self->peer;
+    if(peer) {
+        acquireLockBlocking(&peer->lock);
+
+        SyscallRequest **link = &peer->sendWaiting;
+        while(*link && (*link != req)) link = &(*link)->next;
+        if(*link && req->waiting) {
+            *link = req->next;
+            req->waiting = false;
+            req->next = NULL;
+            woken = true;
+        }
+
+        releaseLock(&peer->lock);
+    }
+
+    socketRelease();
+    if(woken) syscallEnqueue(req);
+}
+
+/* socketWakeSenders(): wakes the senders sleeping on a socket's queue, which
+ * will check the limits again
+ * params: sock - receiving socket
+ * returns: nothing
+ */
+
+void socketWakeSenders(SocketDescriptor *sock) {
+    if(!sock->sendWaiting) return;
+
+    acquireLockBlocking(&sock->lock);
+    SyscallRequest *waiter = sock->sendWaiting;
+    sock->sendWaiting = NULL;
+    releaseLock(&sock->lock);
+
+    while(waiter) {
+        SyscallRequest *next = waiter->next;
+        waiter->waiting = false;
+        waiter->next = NULL;
+        syscallEnqueue(waiter);
+        waiter = next;
+    }
 }
 
 /* recv(): receives a message from a socket connection
@@ -109,55 +613,163 @@ ssize_t send(Thread *t, int sd, const void *buffer, size_t len, int flags) {
  */
 
 ssize_t recv(Thread *t, int sd, void *buffer, size_t len, int flags) {
-    if(sd < 0 || sd >= MAX_IO_DESCRIPTORS) return -EBADF;
-    Process *p;
-    if(t) p = getProcess(t->pid);
-    else p = getProcess(getKernelPID());
-    if(!p) return -ESRCH;
-
-    if(!p->io[sd].valid || !p->io[sd].data || (p->io[sd].type != IO_SOCKET))
-        return -ENOTSOCK;
+    SocketDescriptor *self;
+    int status = socketIODescriptor(t, sd, &self);
+    if(status) return status;
+    // data queued before the peer closed can still be received
+    if(!self->peer && !self->hangup) return -EDESTADDRREQ;  // not in connection mode
 
-    SocketDescriptor *self = (SocketDescriptor*) p->io[sd].data;
-    if(!self->peer) return -EDESTADDRREQ;   // not in connection mode
+    sa_family_t family = self->address.sa_family;
+    if(family != AF_UNIX && family != AF_LOCAL) {
+        /* TODO: handle other protocols in user space */
+        return -ENOTCONN;
+    }
 
     acquireLockBlocking(&self->lock);
+    ssize_t received = socketReceive(t, self, buffer, len, flags);
+    releaseLock(&self->lock);
+
+    // the peer may be able to send again
+    if((received >= 0) && !(flags & MSG_PEEK)) {
+        socketWakeSenders(self);
+        SocketDescriptor *peer = self->peer;
+        if(peer) pollNotify(&peer->watchers);
+    }
+
+    return received;
+}
+
+/* sendmmsg(): sends a batch of messages to a socket connection
+ * params: t - calling thread
+ * params: sd - socket descriptor
+ * params: msgvec - array of messages, the status of each is stored in msg_len
+ * params: vlen - number of messages, at most SOCKET_MMSG_MAX are sent
+ * params: flags - optional flags for the request, as in send()
+ * returns: number of messages sent, negative error code if none were sent
+ *
+ * the peer is locked once for the whole batch; messages are sent in order
+ * and the batch stops at the first one that can't be sent, whose status is
+ * also stored for every message after it
+ */
+
+int sendmmsg(Thread *t, int sd, struct mmsghdr *msgvec, unsigned int vlen, int flags) {
+    SocketDescriptor *self;
+    int status = socketIODescriptor(t, sd, &self);
+    if(status) return status;
+
+    SocketDescriptor *peer = self->peer;
+    if(!peer) return -EDESTADDRREQ;     // not in connection mode
 
     sa_family_t family = self->address.sa_family;
-    if(!self->inboundCount || !self->inbound || !self->inboundLen) {
-        releaseLock(&self->lock);
-        return -EWOULDBLOCK;    // no messages available
+    if(family != AF_UNIX && family != AF_LOCAL) {
+        /* TODO: handle other protocols in user space */
+        return -ENOTCONN;
     }
 
-    if(family == AF_UNIX || family == AF_LOCAL) {
-        // copy from the inbound list
-        void *message = self->inbound[0];   // FIFO
-        size_t truelen = self->inboundLen[0];
+    if(!vlen) return 0;
+    if(vlen > SOCKET_MMSG_MAX) vlen = SOCKET_MMSG_MAX;
 
-        if(!message) {
-            releaseLock(&self->lock);
-            return -EWOULDBLOCK;
+    // copy large messages before taking the peer's lock
+    void *messages[SOCKET_MMSG_MAX];
+    size_t queued[SOCKET_MMSG_MAX];
+    unsigned int prepared = 0;
+    bool stream = (peer->type == SOCK_STREAM);
+    if(!stream) {
+        while(prepared < vlen) {
+            if(socketMessagePrepare(t, msgvec[prepared].msg_buf, msgvec[prepared].msg_size, flags,
+            &messages[prepared], &queued[prepared])) break;
+            prepared++;
         }
+    }
 
-        if(truelen > len) truelen = len;    // truncate longer messages
-        memcpy(buffer, message, truelen);
+    acquireLockBlocking(&peer->lock);
 
-        // remove the received message from the queue if we're in non-peek mode
-        if(!(flags & MSG_PEEK)) {
-            free(message);
+    unsigned int count = 0;
+    ssize_t sent = 0;
+    while(count < vlen) {
+        struct mmsghdr *msg = &msgvec[count];
+        if(stream) sent = socketStreamSend(t, self, peer, msg->msg_buf, msg->msg_size);
+        else if(count < prepared) sent = socketMessageQueue(t, self, peer, msg->msg_buf, msg->msg_size,
+            messages[count], queued[count]);
+        else sent = -ENOBUFS;
 
-            self->inboundCount--;
-            if(self->inboundCount) {
-                memmove(&self->inbound[0], &self->inbound[1], self->inboundCount * sizeof(void *));
-                memmove(&self->inboundLen[0], &self->inboundLen[1], self->inboundCount * sizeof(size_t));
-            }
-        }
+        if(sent < 0) break;
+        msg->msg_len = sent;
+        count++;
+    }
 
-        releaseLock(&self->lock);
-        return truelen;
-    } else {
+    releaseLock(&peer->lock);
+
+    for(unsigned int i = count; i < prepared; i++)
+        socketMessageCancel(t, msgvec[i].msg_buf, msgvec[i].msg_size, messages[i], queued[i]);
+    for(unsigned int i = count; i < vlen; i++)
+        msgvec[i].msg_len = sent;
+
+    if(!count) return sent;
+    pollNotify(&peer->watchers);
+    return count;
+}
+
+/* recvmmsg(): receives a batch of messages from a socket connection
+ * params: t - calling thread
+ * params: sd - socket descriptor
+ * params: msgvec - array of buffers, the status of each is stored in msg_len
+ * params: vlen - number of buffers, at most SOCKET_MMSG_MAX are filled
+ * params: flags - optional flags for the request, as in recv()
+ * returns: number of messages received, negative error code if none were
+ *
+ * the socket is locked once for the whole batch, which returns as soon as
+ * the queue runs dry rather than waiting to fill every buffer; the status
+ * of the first buffer left empty is stored for every buffer after it
+ */
+
+int recvmmsg(Thread *t, int sd, struct mmsghdr *msgvec, unsigned int vlen, int flags) {
+    SocketDescriptor *self;
+    int status = socketIODescriptor(t, sd, &self);
+    if(status) return status;
+    // data queued before the peer closed can still be received
+    if(!self->peer && !self->hangup) return -EDESTADDRREQ;  // not in connection mode
+
+    sa_family_t family = self->address.sa_family;
+    if(family != AF_UNIX && family != AF_LOCAL) {
         /* TODO: handle other protocols in user space */
-        releaseLock(&self->lock);
         return -ENOTCONN;
     }
-}
\ No newline at end of file
+
+    if(!vlen) return 0;
+    if(vlen > SOCKET_MMSG_MAX) vlen = SOCKET_MMSG_MAX;
+    if(flags & MSG_PEEK) vlen = 1;      // peeking never gets past the first message
+
+    acquireLockBlocking(&self->lock);
+
+    unsigned int count = 0;
+    ssize_t received = 0;
+    while(count < vlen) {
+        // report the end of a closed connection only once per batch
+        if(count && self->hangup && !self->inboundCount && !self->streamCount) {
+            received = 0;
+            break;
+        }
+
+        received = socketReceive(t, self, msgvec[count].msg_buf, msgvec[count].msg_size, flags);
+        if(received < 0) break;
+        msgvec[count].msg_len = received;
+        count++;
+    }
+
+    releaseLock(&self->lock);
+
+    for(unsigned int i = count; i < vlen; i++)
+        msgvec[i].msg_len = received;
+
+    if(!count) return received;
+
+    // the peer may be able to send again
+    if(!(flags & MSG_PEEK)) {
+        socketWakeSenders(self);
+        SocketDescriptor *peer = self->peer;
+        if(peer) pollNotify(&peer->watchers);
+    }
+
+    return count;
+}
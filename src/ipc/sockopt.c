@@ -0,0 +1,92 @@
+/*
+ * lux - a lightweight unix-like operating system
+ * Omar Elghoul, 2024
+ *
+ * Core Microkernel
+ */
+
+/* Socket Options */
+/* setsockopt() and getsockopt() are implemented here */
+
+#include <errno.h>
+#include <kernel/socket.h>
+#include <kernel/io.h>
+#include <kernel/sched.h>
+
+/* setsockopt(): sets a socket option
+ * params: t - calling thread, NULL for kernel threads
+ * params: sd - socket descriptor
+ * params: level - protocol level, only SOL_SOCKET is supported
+ * params: option - option to set
+ * params: value - pointer to the new value
+ * params: len - size of the new value
+ * returns: zero on success, negative error code on fail
+ */
+
+int setsockopt(Thread *t, int sd, int level, int option, const void *value, socklen_t len) {
+    SocketDescriptor *sock;
+    int status = socketIODescriptor(t, sd, &sock);
+    if(status) return status;
+    if(level != SOL_SOCKET) return -ENOPROTOOPT;
+    if(!value || (len < sizeof(int))) return -EINVAL;
+
+    int v = *(const int *) value;
+    if(v < 0) return -EINVAL;
+
+    acquireLockBlocking(&sock->lock);
+
+    switch(option) {
+    case SO_SNDBUF:
+        sock->sndbuf = (v < SOCKET_MIN_BUFFER) ? SOCKET_MIN_BUFFER : v;
+        break;
+    case SO_RCVBUF:
+        sock->rcvbuf = (v < SOCKET_MIN_BUFFER) ? SOCKET_MIN_BUFFER : v;
+        break;
+    case SO_RCVMSGS:
+        sock->rcvmsgs = v ? v : 1;
+        break;
+    default:
+        releaseLock(&sock->lock);
+        return -ENOPROTOOPT;
+    }
+
+    releaseLock(&sock->lock);
+
+    // larger limits may let sleeping senders in either direction continue
+    socketLock();
+    socketWakeSenders(sock);
+    if(sock->peer) socketWakeSenders(sock->peer);
+    socketRelease();
+    return 0;
+}
+
+/* getsockopt(): returns the value of a socket option
+ * params: t - calling thread, NULL for kernel threads
+ * params: sd - socket descriptor
+ * params: level - protocol level, only SOL_SOCKET is supported
+ * params: option - option to read
+ * params: value - buffer to store the value in
+ * params: len - size of the buffer, updated with the size of the value
+ * returns: zero on success, negative error code on fail
+ */
+
+int getsockopt(Thread *t, int sd, int level, int option, void *value, socklen_t *len) {
+    SocketDescriptor *sock;
+    int status = socketIODescriptor(t, sd, &sock);
+    if(status) return status;
+    if(level != SOL_SOCKET) return -ENOPROTOOPT;
+    if(!value || !len || (*len < sizeof(int))) return -EINVAL;
+
+    int v;
+    switch(option) {
+    case SO_SNDBUF: v = sock->sndbuf; break;
+    case SO_RCVBUF: v = sock->rcvbuf; break;
+    case SO_RCVMSGS: v = sock->rcvmsgs; break;
+    case SO_TYPE: v = sock->type; break;
+    default: return -ENOPROTOOPT;
+    }
+
+    *(int *) value = v;
+    *len = sizeof(int);
+    return 0;
+}
@@ -20,7 +20,7 @@ static int idleThreshold = 0;
 void *idleThread(void *args) {
     int count = 0;
     for(;;) {
-        if(!syscallProcess()) platformIdle();
+        if(!syscallProcess() && !reclaimStep()) platformIdle();
         count++;
         if(count >= idleThreshold) {
             count = 0;
@@ -106,10 +106,10 @@ int main(int argc, char **argv) {
         idleThreshold = 8;
 
     // number of kernel threads = number of CPU cores + 1
-    kthreadCreate(&kernelThread, NULL);
+    kthreadCreate(&kernelThread, NULL, 0);
 
     for(int i = 0; i < platformCountCPU(); i++)
-        kthreadCreate(&idleThread, NULL);
+        kthreadCreate(&idleThread, NULL, 0);
 
     // now enable the scheduler
     setScheduling(true);
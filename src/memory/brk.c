@@ -44,8 +44,7 @@ void *sbrk(Thread *t, intptr_t delta) {
             return (void *) -ENOMEM;
         }
 
-        memset((void *)ptr, 0, pages*PAGE_SIZE);
-
+        // the pages are zeroed by the page fault handler on first access
         t->pages += pages;
         p->pages += pages;
         t->highest += (pages * PAGE_SIZE);
@@ -0,0 +1,173 @@
+/*
+ * lux - a lightweight unix-like operating system
+ * Omar Elghoul, 2024
+ *
+ * Core Microkernel
+ */
+
+/* DMA Memory Pool */
+
+/* the pool is a block of physical memory reserved below 4 GB at boot, before
+ * the physical memory manager has had a chance to fragment, and it is used to
+ * guarantee contiguous memory to device drivers that need it long after boot
+ * requests that don't fit in the pool fall back to the physical memory
+ * manager; blocks are always whole pages because drivers map them into user
+ * space with mmio() */
+
+#include <stdlib.h>
+#include <string.h>
+#include <kernel/memory.h>
+#include <kernel/logger.h>
+#include <platform/lock.h>
+
+static uintptr_t dmaBase = 0;
+static size_t dmaPages = 0;
+static uint64_t *dmaBitmap;     // one bit per pool page, set = used
+static lock_t lock = LOCK_INITIAL;
+
+/* dmaInit(): reserves the DMA pool, this must be called after the virtual
+ * memory manager is initialized
+ * params: none
+ * returns: nothing
+ */
+
+void dmaInit() {
+    PhysicalMemoryStatus status;
+    pmmStatus(&status);
+
+    size_t pages = status.usablePages / DMA_POOL_DIVISOR;
+    if(pages < DMA_POOL_MIN_PAGES) pages = DMA_POOL_MIN_PAGES;
+    if(pages > DMA_POOL_MAX_PAGES) pages = DMA_POOL_MAX_PAGES;
+    pages = (pages + 63) & ~63;
+
+    size_t words = pages / 64;
+    dmaBitmap = calloc(words, sizeof(uint64_t));
+    if(!dmaBitmap) {
+        KWARN("unable to allocate memory for the DMA pool\n");
+        return;
+    }
+
+    while(pages >= DMA_POOL_MIN_PAGES) {
+        dmaBase = pmmAllocateContiguous(pages, PMM_CONTIGUOUS_LOW);
+        if(dmaBase) break;
+        pages = (pages / 2) & ~63;  // keep whole bitmap words
+    }
+
+    if(!dmaBase) {
+        KWARN("unable to reserve memory for the DMA pool\n");
+        return;
+    }
+
+    dmaPages = pages;
+    KDEBUG("reserved %d KiB for the DMA pool at 0x%08X\n", (dmaPages * PAGE_SIZE) / 1024, dmaBase);
+}
+
+/* dmaFindPages(): finds and marks a contiguous run of free pool pages
+ * params: count - number of pages
+ * returns: index of the first page, -1 on fail
+ */
+
+static ssize_t dmaFindPages(size_t count) {
+    size_t run = 0;
+    size_t page = 0;
+
+    while(page < dmaPages) {
+        uint64_t word = dmaBitmap[page / 64];
+
+        // skip whole words at a time, but never past the end of the pool
+        bool whole = !(page % 64) && ((page + 64) <= dmaPages);
+        if(whole && (word == ~(uint64_t)0)) {
+            run = 0;
+            page += 64;
+        } else if(whole && !word) {
+            run += 64;
+            page += 64;
+        } else {
+            if((word >> (page % 64)) & 1) run = 0;
+            else run++;
+            page++;
+        }
+
+        if(run >= count) {
+            size_t start = page - run;
+            for(size_t i = start; i < start + count; i++) {
+                dmaBitmap[i / 64] |= ((uint64_t)1 << (i % 64));
+            }
+
+            return start;
+        }
+    }
+
+    return -1;
+}
+
+/* dmaFreePages(): returns pages to the pool
+ * params: page - index of the first page
+ * params: count - number of pages
+ * returns: zero on success
+ */
+
+static int dmaFreePages(size_t page, size_t count) {
+    if((page + count) > dmaPages) return -1;
+
+    int status = 0;
+    for(size_t i = page; i < page + count; i++) {
+        uint64_t bit = (uint64_t)1 << (i % 64);
+        if(!(dmaBitmap[i / 64] & bit)) status = -1;
+        else dmaBitmap[i / 64] &= ~bit;
+    }
+
+    return status;
+}
+
+/* dmaAllocate(): allocates physically contiguous memory
+ * params: size - size in bytes, rounded up to PAGE_SIZE
+ * params: flags - requirements for the memory block, see pmmAllocateContiguous()
+ * returns: physical address, zero on fail
+ */
+
+uintptr_t dmaAllocate(size_t size, int flags) {
+    if(!size) return 0;
+
+    size_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    uintptr_t phys = 0;
+
+    if(dmaPages && (flags & PMM_CONTIGUOUS_LOW)) {
+        // the pool is all below 4 GB, so it is the first choice for legacy
+        // devices and the last for everything else
+        acquireLockBlocking(&lock);
+        ssize_t page = dmaFindPages(pages);
+        if(page >= 0) phys = dmaBase + (page * PAGE_SIZE);
+        releaseLock(&lock);
+        if(phys) return phys;
+    }
+
+    phys = pmmAllocateContiguous(pages, flags);
+    if(phys || !dmaPages || (flags & PMM_CONTIGUOUS_LOW)) return phys;
+
+    // fall back to the pool when the rest of memory is too fragmented
+    acquireLockBlocking(&lock);
+    ssize_t page = dmaFindPages(pages);
+    if(page >= 0) phys = dmaBase + (page * PAGE_SIZE);
+    releaseLock(&lock);
+    return phys;
+}
+
+/* dmaFree(): frees physically contiguous memory
+ * params: phys - physical address
+ * params: size - size in bytes as passed to dmaAllocate()
+ * returns: zero on success
+ */
+
+int dmaFree(uintptr_t phys, size_t size) {
+    if(!size || (phys & (PAGE_SIZE-1))) return -1;
+
+    size_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    if(!dmaPages || (phys < dmaBase) || (phys >= (dmaBase + (dmaPages * PAGE_SIZE))))
+        return pmmFreeContiguous(phys, pages);
+
+    acquireLockBlocking(&lock);
+    int status = dmaFreePages((phys - dmaBase) / PAGE_SIZE, pages);
+    releaseLock(&lock);
+    return status;
+}
@@ -60,7 +60,8 @@ void *mmap(Thread *t, uint64_t id, void *addr, size_t len, int prot, int flags,
     
         if(!anon) return (void *) -ENOMEM;
 
-        memset((void *) anon, 0, (pageCount+1) * PAGE_SIZE);
+        // no need to clear the memory here, lazily allocated pages are zeroed
+        // by the page fault handler as they are touched
         MmapHeader *hdr = (MmapHeader *) anon;
         hdr->flags = flags;
         hdr->length = len;
@@ -81,6 +82,11 @@ void *mmap(Thread *t, uint64_t id, void *addr, size_t len, int prot, int flags,
         return (void *) -ESRCH;
     }
 
+    if(fd >= p->iodMax) {
+        free(command);
+        return (void *) -EBADF;
+    }
+
     IODescriptor *io = &p->io[fd];
     if(!io->valid || !io->data) {
         free(command);
@@ -203,7 +209,7 @@ int munmap(Thread *t, void *addr, size_t len) {
     if(fd > 0 && fd <= MAX_IO_DESCRIPTORS) {
         Process *p = getProcess(t->pid);
         if(!p) return -ESRCH;
-        if(!p->io[fd].valid || (p->io[fd].type != IO_FILE))
+        if(fd >= p->iodMax || !p->io[fd].valid || (p->io[fd].type != IO_FILE))
             return -EINVAL;
         
         FileDescriptor *file = (FileDescriptor *) p->io[header->fd].data;
@@ -253,7 +259,7 @@ int msync(Thread *t, uint64_t id, void *addr, size_t len, int flags) {
 
     Process *p = getProcess(t->pid);
     if(!p) return -ESRCH;
-    if(!p->io[header->fd].valid || (p->io[header->fd].type != IO_FILE))
+    if(header->fd >= p->iodMax || !p->io[header->fd].valid || (p->io[header->fd].type != IO_FILE))
         return -EINVAL;
 
     FileDescriptor *file = (FileDescriptor *) p->io[header->fd].data;
@@ -11,6 +11,8 @@
 #define MMIO_W          0x02    // write perms
 #define MMIO_X          0x04    // execute perms
 #define MMIO_CD         0x08    // cache disable
+#define MMIO_WC         0x10    // write-combining, for frame buffers
+#define MMIO_WT         0x20    // write-through
 #define MMIO_ENABLE     0x80    // create mapping; clear to unmap
 
 #include <kernel/logger.h>
@@ -46,6 +48,8 @@ uintptr_t mmio(Thread *t, uintptr_t addr, off_t count, int flags) {
         if(flags & MMIO_W) pageFlags |= PLATFORM_PAGE_WRITE;
         if(flags & MMIO_X) pageFlags |= PLATFORM_PAGE_EXEC;
         if(flags & MMIO_CD) pageFlags |= PLATFORM_PAGE_NO_CACHE;
+        else if(flags & MMIO_WC) pageFlags |= PLATFORM_PAGE_WRITE_COMBINE;
+        else if(flags & MMIO_WT) pageFlags |= PLATFORM_PAGE_WRITE_THROUGH;
 
         uintptr_t virt = vmmAllocate(USER_MMIO_BASE, USER_LIMIT_ADDRESS, pageCount, VMM_USER);
         if(!virt) return 0;
@@ -13,12 +13,40 @@
 #include <kernel/boot.h>
 #include <kernel/logger.h>
 #include <platform/lock.h>
+#include <platform/platform.h>
 
 static PhysicalMemoryStatus status;
-static uint8_t *pmmBitmap;
+static uint64_t *pmmBitmap;
 static size_t pmmBitmapSize;
 static lock_t lock = LOCK_INITIAL;
 
+// summary level of the bitmap: one bit per 64-page word of the bitmap, set
+// when the word has at least one free page, so that allocations can skip
+// over fully used regions 4096 pages at a time
+static uint64_t *pmmSummary;
+static size_t pmmSummarySize;
+
+// index of the lowest bitmap word that may have a free page
+static size_t pmmHint;
+
+// number of page colors, always a power of two that divides 64 so that every
+// word in the bitmap covers the same pattern of colors
+static int pmmColorCount = 1;
+
+/* pmmUpdateSummary(): updates the summary bit corresponding to a bitmap word
+ * params: word - index of the word in the bitmap
+ * returns: nothing
+ */
+
+static inline void pmmUpdateSummary(size_t word) {
+    if(pmmBitmap[word] == ~(uint64_t)0) {
+        pmmSummary[word / 64] &= ~((uint64_t)1 << (word % 64));
+    } else {
+        pmmSummary[word / 64] |= ((uint64_t)1 << (word % 64));
+        if(word < pmmHint) pmmHint = word;
+    }
+}
+
 /* pmmMark(): marks a page as free or used
  * params: phys - physical address
  * params: use - whether the page is used
@@ -27,25 +55,26 @@ static lock_t lock = LOCK_INITIAL;
 
 int pmmMark(uintptr_t phys, bool use) {
     uintptr_t page = phys / PAGE_SIZE;
-    uintptr_t byte = page / 8;
-    uintptr_t bit = page % 8;
+    uintptr_t word = page / 64;
+    uint64_t bit = (uint64_t)1 << (page % 64);
 
     if(use) {
-        if(pmmBitmap[byte] & (1 << bit)) {
+        if(pmmBitmap[word] & bit) {
             return -1;      // already marked as used
         } else {
-            pmmBitmap[byte] |= (1 << bit);
+            pmmBitmap[word] |= bit;
             status.usedPages++;
         }
     } else {
-        if(!(pmmBitmap[byte] & (1 << bit))) {
+        if(!(pmmBitmap[word] & bit)) {
             return -1;      // already marked as free 
         } else {
-            pmmBitmap[byte] &= ~(1 << bit);
+            pmmBitmap[word] &= ~bit;
             status.usedPages--;
         }
     }
 
+    pmmUpdateSummary(word);
     return 0;
 }
 
@@ -66,32 +95,74 @@ int pmmMarkContiguous(uintptr_t phys, size_t count, bool use) {
     return status;
 }
 
-/* pmmInitMark(): marks pages as free or used without checking their status
- * this is necessary during the startup process while parsing the memory map 
- * params: phys - physical address
- * params: use - whether the page is used
- * returns: nothing
+/* pmmMarkRange(): marks a range of pages as free or used a word at a time
+ * this does not touch the summary level or the page counters
+ * params: page - first page number
+ * params: count - number of pages
+ * params: use - whether the pages are used
+ * returns: number of pages whose state actually changed
  */
 
-static void pmmInitMark(uintptr_t phys, bool use) {
-    uintptr_t page = phys / PAGE_SIZE;
-    uintptr_t byte = page / 8;
-    uintptr_t bit = page % 8;
+static size_t pmmMarkRange(uintptr_t page, size_t count, bool use) {
+    if(page >= status.highestPage) return 0;
+    if((page + count) > status.highestPage) count = status.highestPage - page;
 
-    if(use) {
-        pmmBitmap[byte] |= (1 << bit);
-        status.reservedPages++;
-    } else {
-        pmmBitmap[byte] &= ~(1 << bit);
-        status.usablePages++;
+    size_t changed = 0;
+
+    while(count) {
+        uintptr_t word = page / 64;
+        int bit = page % 64;
+        uint64_t mask;
+        size_t n;
+
+        if(!bit && count >= 64) {
+            // whole words at once
+            size_t words = count / 64;
+            for(size_t i = 0; i < words; i++) {
+                if(use) changed += 64 - __builtin_popcountll(pmmBitmap[word+i]);
+                else changed += __builtin_popcountll(pmmBitmap[word+i]);
+            }
+
+            memset(&pmmBitmap[word], use ? 0xFF : 0x00, words * sizeof(uint64_t));
+            n = words * 64;
+        } else {
+            // partial word at the edges of the range
+            n = 64 - bit;
+            if(n > count) n = count;
+
+            if(n == 64) mask = ~(uint64_t)0;
+            else mask = (((uint64_t)1 << n) - 1) << bit;
+
+            if(use) {
+                changed += n - __builtin_popcountll(pmmBitmap[word] & mask);
+                pmmBitmap[word] |= mask;
+            } else {
+                changed += __builtin_popcountll(pmmBitmap[word] & mask);
+                pmmBitmap[word] &= ~mask;
+            }
+        }
+
+        page += n;
+        count -= n;
     }
+
+    return changed;
 }
 
+/* pmmInitMarkContiguous(): marks pages as free or used without checking their
+ * status; this is necessary during the startup process while parsing the
+ * memory map
+ * params: phys - physical address
+ * params: count - number of pages
+ * params: use - whether the pages are used
+ * returns: nothing
+ */
+
 static void pmmInitMarkContiguous(uintptr_t phys, size_t count, bool use) {
-    for(size_t i = 0; i < count; i++) {
-        pmmInitMark(phys, use);
-        phys += PAGE_SIZE;
-    }
+    pmmMarkRange(phys / PAGE_SIZE, count, use);
+
+    if(use) status.reservedPages += count;
+    else status.usablePages += count;
 }
 
 /* pmmInit(): this is called from platformMain() early in the boot process
@@ -104,12 +175,16 @@ void pmmInit(KernelBootInfo *boot) {
 
     // this is set by the boot loader and is guaranteed to be page-aligned
     // it accounts for modules, ramdisk, and other things loaded in memory
-    pmmBitmap = (uint8_t *)boot->lowestFreeMemory + KERNEL_BASE_ADDRESS;
+    pmmBitmap = (uint64_t *)(boot->lowestFreeMemory + KERNEL_BASE_ADDRESS);
 
     status.highestPhysicalAddress = boot->highestPhysicalAddress;
     status.highestPage = (status.highestPhysicalAddress + PAGE_SIZE - 1) / PAGE_SIZE;
 
-    pmmBitmapSize = (status.highestPage + 7) / 8;
+    pmmBitmapSize = ((status.highestPage + 63) / 64) * sizeof(uint64_t);
+
+    // the summary level immediately follows the bitmap
+    pmmSummary = (uint64_t *)((uintptr_t)pmmBitmap + pmmBitmapSize);
+    pmmSummarySize = ((pmmBitmapSize / sizeof(uint64_t)) + 63) / 64;
 
     // reset the bitmap reserving everything, and then mark the RAM regions as free later
     memset(pmmBitmap, 0xFF, pmmBitmapSize);
@@ -158,18 +233,34 @@ void pmmInit(KernelBootInfo *boot) {
     }
 
     // now reserve all the kernel's memory including ramdisks, modules, etc
-    size_t kernelPages = (boot->lowestFreeMemory + pmmBitmapSize + PAGE_SIZE - 1) / PAGE_SIZE;
+    size_t kernelPages = (boot->lowestFreeMemory + pmmBitmapSize + (pmmSummarySize * sizeof(uint64_t))
+        + PAGE_SIZE - 1) / PAGE_SIZE;
 
-    pmmMarkContiguous(0, kernelPages, true);
+    status.usedPages += pmmMarkRange(0, kernelPages, true);
 
     status.lowestUsableAddress = (uintptr_t)kernelPages * PAGE_SIZE;
 
+    // build the summary level in one pass now that the bitmap is final
+    memset(pmmSummary, 0, pmmSummarySize * sizeof(uint64_t));
+    pmmHint = pmmBitmapSize / sizeof(uint64_t);
+    for(size_t i = 0; i < pmmBitmapSize / sizeof(uint64_t); i++) {
+        pmmUpdateSummary(i);
+    }
+
+    // page coloring is only useful when the last-level cache is larger than
+    // one page per way
+    int colors = platformCacheColors();
+    while((pmmColorCount << 1) <= colors && (pmmColorCount << 1) <= PMM_MAX_COLORS)
+        pmmColorCount <<= 1;
+
     KDEBUG("highest kernel address is 0x%08X\n", boot->kernelHighestAddress);
     KDEBUG("highest physical address is 0x%08X\n", boot->highestPhysicalAddress);
     KDEBUG("lowest usable address is 0x%08X\n", status.lowestUsableAddress);
     KDEBUG("highest usable address is 0x%08X\n", status.highestUsableAddress);
 
     KDEBUG("bitmap size = %d pages (%d KiB)\n", (pmmBitmapSize+PAGE_SIZE-1)/PAGE_SIZE, pmmBitmapSize/1024);
+    KDEBUG("bitmap summary size = %d bytes\n", pmmSummarySize * sizeof(uint64_t));
+    KDEBUG("last-level cache has %d page colors\n", pmmColorCount);
     KDEBUG("total usable memory = %d pages (%d MiB)\n", status.usablePages, (status.usablePages * PAGE_SIZE) / 0x100000);
     KDEBUG("kernel-reserved memory = %d pages (%d MiB)\n", status.usedPages, (status.usedPages * PAGE_SIZE) / 0x100000);
     KDEBUG("hardware-reserved memory = %d pages (%d KiB)\n", status.reservedPages, (status.reservedPages * PAGE_SIZE) / 1024);
@@ -194,10 +285,7 @@ bool pmmIsUsed(uintptr_t phys) {
     if(phys >= status.highestUsableAddress) return true;
 
     uintptr_t page = phys / PAGE_SIZE;
-    uintptr_t byte = page / 8;
-    uintptr_t bit = page % 8;
-
-    return ((pmmBitmap[byte] >> bit) & 1);
+    return ((pmmBitmap[page / 64] >> (page % 64)) & 1);
 }
 
 /* pmmAllocate(): allocates one page
@@ -207,20 +295,82 @@ bool pmmIsUsed(uintptr_t phys) {
 
 uintptr_t pmmAllocate(void) {
     acquireLockBlocking(&lock);
-    uintptr_t addr;
 
-    for(addr = status.lowestUsableAddress; addr < status.highestUsableAddress; addr += PAGE_SIZE) {
-        if(!pmmIsUsed(addr)) {
-            pmmMark(addr, true);
-            //KDEBUG("allocated physical page at 0x%08X, %d pages in use\n", addr, status.usedPages);
+    // use the summary level to find the first bitmap word with a free page,
+    // starting from the lowest word that is known to possibly have one
+    for(size_t i = pmmHint / 64; i < pmmSummarySize; i++) {
+        uint64_t summary = pmmSummary[i];
+        if(i == pmmHint / 64) summary &= ~(uint64_t)0 << (pmmHint % 64);
+        if(!summary) continue;
+
+        size_t word = (i * 64) + __builtin_ctzll(summary);
+        uintptr_t page = (word * 64) + __builtin_ctzll(~pmmBitmap[word]);
+        uintptr_t addr = page * PAGE_SIZE;
+
+        pmmHint = word;
+        if(addr >= status.highestUsableAddress) break;
+
+        pmmMark(addr, true);
+        //KDEBUG("allocated physical page at 0x%08X, %d pages in use\n", addr, status.usedPages);
+
+        releaseLock(&lock);
+        return addr;
+    }
 
+    releaseLock(&lock);
+    return 0;
+}
+
+/* pmmColors(): returns the number of page colors
+ * params: none
+ * returns: number of page colors, one if page coloring is not available
+ */
+
+int pmmColors() {
+    return pmmColorCount;
+}
+
+/* pmmAllocateColor(): allocates one page from a set of cache colors
+ * params: colors - bitmap of acceptable colors, zero for any
+ * returns: physical address of the page allocated, zero on fail
+ */
+
+uintptr_t pmmAllocateColor(uint64_t colors) {
+    if(pmmColorCount > 1) colors &= ((pmmColorCount < 64) ? (((uint64_t)1 << pmmColorCount) - 1) : ~(uint64_t)0);
+    if(!colors || pmmColorCount <= 1) return pmmAllocate();
+
+    // build the mask of acceptable pages within one word of the bitmap
+    uint64_t pattern = 0;
+    for(int i = 0; i < 64; i++) {
+        if(colors & ((uint64_t)1 << (i % pmmColorCount))) pattern |= ((uint64_t)1 << i);
+    }
+
+    acquireLockBlocking(&lock);
+
+    for(size_t i = pmmHint / 64; i < pmmSummarySize; i++) {
+        uint64_t summary = pmmSummary[i];
+        if(i == pmmHint / 64) summary &= ~(uint64_t)0 << (pmmHint % 64);
+
+        while(summary) {
+            size_t word = (i * 64) + __builtin_ctzll(summary);
+            summary &= summary - 1;
+
+            uint64_t free = ~pmmBitmap[word] & pattern;
+            if(!free) continue;
+
+            uintptr_t addr = ((word * 64) + __builtin_ctzll(free)) * PAGE_SIZE;
+            if(addr >= status.highestUsableAddress) break;
+
+            pmmMark(addr, true);
             releaseLock(&lock);
             return addr;
         }
     }
 
     releaseLock(&lock);
-    return 0;
+
+    // fall back to any color rather than failing
+    return pmmAllocate();
 }
 
 /* pmmFree(): frees one page
@@ -229,7 +379,7 @@ uintptr_t pmmAllocate(void) {
  */
 
 int pmmFree(uintptr_t phys) {
-    if(phys <= status.lowestUsableAddress || phys >= status.highestUsableAddress) return -1;
+    if(phys < status.lowestUsableAddress || phys >= status.highestUsableAddress) return -1;
     //KDEBUG("freeing memory at 0x%08X, %d pages in use\n", phys, status.usedPages);
 
     acquireLockBlocking(&lock);
@@ -238,6 +388,26 @@ int pmmFree(uintptr_t phys) {
     return s;
 }
 
+/* pmmFreeBatch(): frees a set of pages that need not be contiguous, taking
+ * the lock only once
+ * params: pages - array of physical addresses
+ * params: count - number of pages
+ * returns: zero on success
+ */
+
+int pmmFreeBatch(const uintptr_t *pages, size_t count) {
+    int s = 0;
+
+    acquireLockBlocking(&lock);
+    for(size_t i = 0; i < count; i++) {
+        if(pages[i] < status.lowestUsableAddress || pages[i] >= status.highestUsableAddress) s = -1;
+        else s |= pmmMark(pages[i], false);
+    }
+    releaseLock(&lock);
+
+    return s;
+}
+
 /* pmmAllocateContiguous(): allocates contiguous physical memory
  * params: count - how many pages to allocate
  * params: flags - requirements for the memory block
@@ -250,35 +420,44 @@ uintptr_t pmmAllocateContiguous(size_t count, int flags) {
     // this is going to become necessary in drivers for devices that only have
     // a 32-bit addressing mode, like certain DMA and network controllers
 
+    if(!count) return 0;
+
     acquireLockBlocking(&lock);
 
-    uintptr_t start = status.lowestUsableAddress;
+    uintptr_t page = status.lowestUsableAddress / PAGE_SIZE;
     uintptr_t end;
     if(flags & PMM_CONTIGUOUS_LOW && status.highestUsableAddress > 0xFFFFFFFF) {
-        end = 0xFFFFF000;   // last page of the 32-bit address space
+        end = 0x100000000 / PAGE_SIZE;  // first page above the 32-bit address space
     } else {
-        end = status.highestUsableAddress - (count * PAGE_SIZE);
+        end = status.highestUsableAddress / PAGE_SIZE;
     }
 
-    uintptr_t addr;
+    // single pass over the bitmap tracking the length of the current run of
+    // free pages, skipping over whole words that are entirely used or free
+    size_t run = 0;
 
-    do {
-        for(addr = start; addr < (start + (count * PAGE_SIZE)); addr += PAGE_SIZE) {
-            if(pmmIsUsed(addr)) break;
-        }
+    while(page < end) {
+        uint64_t word = pmmBitmap[page / 64];
 
-        if(addr >= (start + (count * PAGE_SIZE))) {
-            if(!pmmMarkContiguous(start, count, true)) {
-                releaseLock(&lock);
-                return start;
-            }
+        if(!(page % 64) && (word == ~(uint64_t)0)) {
+            run = 0;
+            page += 64;
+        } else if(!(page % 64) && !word && ((page + 64) <= end)) {
+            run += 64;
+            page += 64;
+        } else {
+            if((word >> (page % 64)) & 1) run = 0;
+            else run++;
+            page++;
+        }
 
+        if(run >= count) {
+            uintptr_t start = (page - run) * PAGE_SIZE;
+            int s = pmmMarkContiguous(start, count, true);
             releaseLock(&lock);
-            return 0;
-        } else {
-            start += PAGE_SIZE;
+            return s ? 0 : start;
         }
-    } while(start < end);
+    }
 
     releaseLock(&lock);
     return 0;
@@ -303,7 +482,7 @@ int pmmFreeContiguous(uintptr_t phys, size_t count) {
 /* pcontig(): allocates or deallocates contiguous physical memory for drivers
  * params: t - calling thread
  * params: addr - address to free, zero for allocations
- * params: count - number of bytes to allocate, will be rounded up to PAGE_SIZE
+ * params: count - number of bytes to allocate, rounded up to PAGE_SIZE
  * params: flags - flags for the memory to be allocated
  * returns: allocations: pointer to physical memory, zero on fail
  * returns: deallocations: zero on success, pointer to physical memory on fail
@@ -315,14 +494,14 @@ uintptr_t pcontig(Thread *t, uintptr_t addr, off_t count, int flags) {
 
     // only root can do this
     if(p->user) return 0;
-
-    size_t pageCount = (count + PAGE_SIZE - 1) / PAGE_SIZE;
+    if(count <= 0) return 0;
 
     if(!addr) {
         // allocating
-        return pmmAllocateContiguous(pageCount, flags);
+        return dmaAllocate(count, flags);
     } else {
         // deallocating
-        return pmmFreeContiguous(addr, pageCount);
+        if(dmaFree(addr, count)) return addr;
+        else return 0;
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,252 @@
+/*
+ * lux - a lightweight unix-like operating system
+ * Omar Elghoul, 2024
+ *
+ * Core Microkernel
+ */
+
+/* Copying Data To and From User Threads */
+
+/* these walk the page tables of the target thread and access its memory
+ * through the kernel's direct mapping of physical memory, so the caller
+ * doesn't need to be running in the thread's address space and doesn't have
+ * to switch paging contexts just to deliver a syscall's results */
+
+#include <errno.h>
+#include <string.h>
+#include <platform/platform.h>
+#include <kernel/memory.h>
+#include <kernel/sched.h>
+
+/* userPage(): resolves one page of a thread's address space, bringing in
+ * lazily allocated pages as necessary
+ * params: t - thread
+ * params: addr - logical address in the thread's address space
+ * params: write - whether the page will be written to
+ * returns: pointer to the page through the direct mapping, zero on fail
+ */
+
+static uintptr_t userPage(Thread *t, uintptr_t addr, bool write) {
+    if(addr >= USER_LIMIT_ADDRESS) return 0;
+
+    int index, status;
+    void *table = platformGetContextPageTable(t->context, addr, &index);
+    if(!table) return 0;
+
+    uintptr_t phys = platformGetPageEntry(table, index, &status);
+    if(!(status & PLATFORM_PAGE_USER)) return 0;
+    if(write && !(status & PLATFORM_PAGE_WRITE)) return 0;
+
+    if(status & PLATFORM_PAGE_PRESENT) return vmmMMIO(phys, true);
+    if((phys & VMM_PAGE_SWAP_MASK) != VMM_PAGE_ALLOCATE) return 0;
+
+    // same as the page fault handler, only without the fault
+    Process *p = getProcess(t->pid);
+    uintptr_t old = phys;
+    phys = pmmAllocateColor(p ? p->colors : 0);
+    if(!phys) return 0;
+
+    uintptr_t ptr = vmmMMIO(phys, true);
+    if(!ptr) {
+        pmmFree(phys);
+        return 0;
+    }
+
+    // the thread may be faulting the same page in on another CPU, so only
+    // install the page if the entry is still unchanged and otherwise use
+    // whatever the other CPU put there
+    memset((void *) ptr, 0, PAGE_SIZE);
+    if(!platformReplacePageEntry(table, index, old, status, phys, status | PLATFORM_PAGE_PRESENT)) {
+        pmmFree(phys);
+        return userPage(t, addr, write);
+    }
+
+    return ptr;
+}
+
+/* copyToUser(): copies data from the kernel into a thread's memory
+ * params: t - destination thread
+ * params: dst - destination address in the thread's address space
+ * params: src - source buffer in kernel memory
+ * params: n - number of bytes to copy
+ * returns: zero on success, -EFAULT if the destination is not writable
+ */
+
+int copyToUser(Thread *t, void *dst, const void *src, size_t n) {
+    uintptr_t addr = (uintptr_t) dst;
+    const uint8_t *buffer = (const uint8_t *) src;
+
+    while(n) {
+        size_t offset = addr & (PAGE_SIZE-1);
+        size_t chunk = PAGE_SIZE - offset;
+        if(chunk > n) chunk = n;
+
+        uintptr_t page = userPage(t, addr - offset, true);
+        if(!page) return -EFAULT;
+        memcpy((void *)(page + offset), buffer, chunk);
+
+        addr += chunk;
+        buffer += chunk;
+        n -= chunk;
+    }
+
+    return 0;
+}
+
+/* copyFromUser(): copies data from a thread's memory into the kernel
+ * params: t - source thread
+ * params: dst - destination buffer in kernel memory
+ * params: src - source address in the thread's address space
+ * params: n - number of bytes to copy
+ * returns: zero on success, -EFAULT if the source is not readable
+ */
+
+int copyFromUser(Thread *t, void *dst, const void *src, size_t n) {
+    uintptr_t addr = (uintptr_t) src;
+    uint8_t *buffer = (uint8_t *) dst;
+
+    while(n) {
+        size_t offset = addr & (PAGE_SIZE-1);
+        size_t chunk = PAGE_SIZE - offset;
+        if(chunk > n) chunk = n;
+
+        uintptr_t page = userPage(t, addr - offset, false);
+        if(!page) return -EFAULT;
+        memcpy(buffer, (const void *)(page + offset), chunk);
+
+        addr += chunk;
+        buffer += chunk;
+        n -= chunk;
+    }
+
+    return 0;
+}
+
+/* userMovablePages(): checks whether the pages backing a buffer may be moved
+ * between address spaces
+ * params: t - thread owning the buffer
+ * params: addr - page-aligned logical address of the buffer
+ * params: count - number of pages
+ * returns: true if the pages may be moved
+ */
+
+static bool userMovablePages(Thread *t, uintptr_t addr, size_t count) {
+    if(addr & (PAGE_SIZE-1)) return false;
+
+    // only the program's own anonymous memory may move; everything mapped
+    // above USER_MMIO_BASE may be device memory, DMA buffers or pages shared
+    // with the kernel, whatever its cache attributes say
+    if((addr >= USER_MMIO_BASE) || (count > ((USER_MMIO_BASE - addr) / PAGE_SIZE)))
+        return false;
+
+    // the old translations are only flushed on this CPU, which is only safe
+    // if no other thread can be running in the address space
+    Process *p = getProcess(t->pid);
+    return p && (p->threadCount <= 1);
+}
+
+/* userDetachPages(): takes away the physical pages backing a buffer so they
+ * can be handed to another thread without copying, leaving lazily allocated
+ * memory in their place
+ * params: t - thread owning the buffer
+ * params: addr - page-aligned logical address of the buffer
+ * params: count - number of pages
+ * params: pages - array to store the physical addresses of the pages in
+ * returns: zero on success, -EFAULT if the buffer is not ordinary writable
+ *          memory of a single-threaded process, in which case it is left
+ *          untouched
+ */
+
+int userDetachPages(Thread *t, uintptr_t addr, size_t count, uintptr_t *pages) {
+    if(!userMovablePages(t, addr, count)) return -EFAULT;
+
+    // bring in every page first so that a failure leaves the buffer intact
+    for(size_t i = 0; i < count; i++) {
+        uintptr_t page = addr + (i * PAGE_SIZE);
+        if(!userPage(t, page, true)) return -EFAULT;
+
+        int index, status;
+        void *table = platformGetContextPageTable(t->context, page, &index);
+        platformGetPageEntry(table, index, &status);
+
+        // never hand out device memory or pages the kernel owns
+        if(status & (PLATFORM_PAGE_NO_CACHE | PLATFORM_PAGE_WRITE_COMBINE | PLATFORM_PAGE_WRITE_THROUGH | PLATFORM_PAGE_SHARED))
+            return -EFAULT;
+    }
+
+    for(size_t i = 0; i < count; i++) {
+        uintptr_t page = addr + (i * PAGE_SIZE);
+        int index, status;
+        void *table = platformGetContextPageTable(t->context, page, &index);
+        pages[i] = platformGetPageEntry(table, index, &status);
+        if((status & PLATFORM_PAGE_PRESENT) &&
+        platformReplacePageEntry(table, index, pages[i], status, VMM_PAGE_ALLOCATE, status & ~PLATFORM_PAGE_PRESENT)) {
+            platformInvalidatePage(t->context, page);
+            continue;
+        }
+
+        // the entry changed under us, so put back what was already taken
+        while(i) {
+            i--;
+            page = addr + (i * PAGE_SIZE);
+            table = platformGetContextPageTable(t->context, page, &index);
+            platformGetPageEntry(table, index, &status);
+            if(!platformReplacePageEntry(table, index, VMM_PAGE_ALLOCATE, status, pages[i],
+            (status & ~PLATFORM_PAGE_SWAP) | PLATFORM_PAGE_PRESENT))
+                pmmFree(pages[i]);
+        }
+
+        return -EFAULT;
+    }
+
+    return 0;
+}
+
+/* userAttachPages(): maps physical pages detached from another thread into
+ * a buffer, freeing the pages that were previously backing it
+ * params: t - thread owning the buffer
+ * params: addr - page-aligned logical address of the buffer
+ * params: count - number of pages
+ * params: pages - physical addresses of the pages, ownership is transferred
+ * returns: zero on success, -EFAULT if the buffer is not ordinary writable
+ *          memory of a single-threaded process, in which case it is left
+ *          untouched
+ */
+
+int userAttachPages(Thread *t, uintptr_t addr, size_t count, const uintptr_t *pages) {
+    if(!userMovablePages(t, addr, count)) return -EFAULT;
+
+    for(size_t i = 0; i < count; i++) {
+        uintptr_t page = addr + (i * PAGE_SIZE);
+        if(page >= USER_LIMIT_ADDRESS) return -EFAULT;
+
+        int index, status;
+        void *table = platformGetContextPageTable(t->context, page, &index);
+        if(!table) return -EFAULT;
+
+        uintptr_t phys = platformGetPageEntry(table, index, &status);
+        if(!(status & PLATFORM_PAGE_USER) || !(status & PLATFORM_PAGE_WRITE)) return -EFAULT;
+        if(status & (PLATFORM_PAGE_NO_CACHE | PLATFORM_PAGE_WRITE_COMBINE | PLATFORM_PAGE_WRITE_THROUGH | PLATFORM_PAGE_SHARED))
+            return -EFAULT;
+        if(!(status & PLATFORM_PAGE_PRESENT) && ((phys & VMM_PAGE_SWAP_MASK) != VMM_PAGE_ALLOCATE))
+            return -EFAULT;
+    }
+
+    for(size_t i = 0; i < count; i++) {
+        uintptr_t page = addr + (i * PAGE_SIZE);
+        int index, status;
+        void *table = platformGetContextPageTable(t->context, page, &index);
+        uintptr_t phys;
+        do {
+            phys = platformGetPageEntry(table, index, &status);
+        } while(!platformReplacePageEntry(table, index, phys, status, pages[i],
+                (status & ~PLATFORM_PAGE_SWAP) | PLATFORM_PAGE_PRESENT));
+
+        if(status & PLATFORM_PAGE_PRESENT) {
+            platformInvalidatePage(t->context, page);
+            pmmFree(phys);
+        }
+    }
+
+    return 0;
+}
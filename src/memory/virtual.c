@@ -92,6 +92,24 @@ uintptr_t vmmAllocate(uintptr_t base, uintptr_t limit, size_t count, int flags)
     return 0;
 }
 
+/* vmmGuard(): turns pages into guard pages, which stay reserved but can never
+ * be accessed, so that running off the end of a stack faults cleanly instead
+ * of corrupting whatever is mapped next to it
+ * params: addr - logical address
+ * params: count - page count
+ * returns: 0 on success
+ */
+
+int vmmGuard(uintptr_t addr, size_t count) {
+    addr &= ~(PAGE_SIZE-1);
+
+    for(size_t i = 0; i < count; i++) {
+        if(!platformMapPage(addr + (i*PAGE_SIZE), VMM_PAGE_GUARD, 0)) return -1;
+    }
+
+    return 0;
+}
+
 /* vmmFree(): frees virtual memory and associated physical memory/swap space
  * params: addr - logical address to be freed
  * params: count - page count
@@ -111,6 +129,8 @@ int vmmFree(uintptr_t addr, size_t count) {
         pageStatus = vmmPageStatus(addr + (i * PAGE_SIZE), &phys);
         if(pageStatus & PLATFORM_PAGE_ERROR) {
             status |= 1;
+        } else if(pageStatus & PLATFORM_PAGE_SHARED) {
+            // owned by the kernel, only the mapping goes away
         } else if(pageStatus & PLATFORM_PAGE_PRESENT) {
             status |= pmmFree(phys);
         } else if(pageStatus & PLATFORM_PAGE_SWAP) {
@@ -124,6 +144,83 @@ int vmmFree(uintptr_t addr, size_t count) {
     return status;
 }
 
+/* vmmFaultAroundPage(): brings in one neighbouring page during fault-around
+ * params: table - page table containing the page
+ * params: index - index of the page in the page table
+ * params: logical - logical address of the page
+ * params: status - attributes of the page that caused the fault
+ * params: colors - page colors to allocate from
+ * returns: true if the page was brought in
+ */
+
+static bool vmmFaultAroundPage(void *table, int index, uintptr_t logical, int status, uint64_t colors) {
+    // only touch pages that belong to the same kind of lazy allocation
+    int s;
+    uintptr_t phys = platformGetPageEntry(table, index, &s);
+    if((s != status) || ((phys & VMM_PAGE_SWAP_MASK) != VMM_PAGE_ALLOCATE)) return false;
+
+    uintptr_t old = phys;
+    phys = pmmAllocateColor(colors);
+    if(!phys) return false;
+
+    memset((void *)vmmMMIO(phys, true), 0, PAGE_SIZE);
+    if(!platformReplacePageEntry(table, index, old, status, phys, status | PLATFORM_PAGE_PRESENT)) {
+        pmmFree(phys);
+        return false;
+    }
+
+    return true;
+}
+
+/* vmmFaultAround(): brings in neighbouring pages after a page fault when the
+ * faulting thread appears to be walking through memory in a steady stride,
+ * doubling the window on every fault that continues the stride
+ * params: table - page table containing the page that caused the fault
+ * params: index - index of the page that caused the fault
+ * params: page - logical address of the page that caused the fault
+ * params: status - attributes of the page that caused the fault
+ * params: colors - page colors to allocate from
+ * returns: nothing
+ */
+
+static void vmmFaultAround(void *table, int index, uintptr_t page, int status, uint64_t colors) {
+    Thread *t = platformGetThread();
+    if(!t) return;
+
+    int window = 0;
+    if((t->faultWindow >= 0) && (page == t->faultAddress + PAGE_SIZE)) {
+        // continuing upwards
+        window = t->faultWindow ? t->faultWindow * 2 : 1;
+        if(window > VMM_FAULT_AROUND_MAX) window = VMM_FAULT_AROUND_MAX;
+    } else if((t->faultWindow <= 0) && (page == t->faultAddress - PAGE_SIZE)) {
+        // continuing downwards, i.e. stacks
+        window = t->faultWindow ? t->faultWindow * 2 : -1;
+        if(window < -VMM_FAULT_AROUND_MAX) window = -VMM_FAULT_AROUND_MAX;
+    }
+
+    // stay within the page table we already walked to
+    int count = 0;
+    if(window > 0) {
+        for(int i = index + 1; (i <= index + window) && (i < PAGE_TABLE_ENTRIES); i++) {
+            if(!vmmFaultAroundPage(table, i, page + ((i - index) * PAGE_SIZE), status, colors)) break;
+            count++;
+        }
+
+        t->faultAddress = page + (count * PAGE_SIZE);
+    } else if(window < 0) {
+        for(int i = index - 1; (i >= index + window) && (i >= 0); i--) {
+            if(!vmmFaultAroundPage(table, i, page - ((index - i) * PAGE_SIZE), status, colors)) break;
+            count++;
+        }
+
+        t->faultAddress = page - (count * PAGE_SIZE);
+    } else {
+        t->faultAddress = page;
+    }
+
+    t->faultWindow = window;
+}
+
 /* vmmPageFault(): platform-independent page fault handler
  * params: addr - logical address that caused the fault
  * params: access - access conditions that caused the fault
@@ -139,13 +236,23 @@ int vmmPageFault(uintptr_t addr, int access) {
         return -1;
     }
 
-    // get the conditions of the page that caused the fault
-    uintptr_t phys;
-    int status = vmmPageStatus(addr & ~(PAGE_SIZE-1), &phys);
+    // get the conditions of the page that caused the fault, keeping the page
+    // table around so that the page and its neighbours can be mapped without
+    // walking the paging structures again
+    uintptr_t page = addr & ~(PAGE_SIZE-1);
+    int index;
+    void *table = platformGetPageTable(page, &index);
+    if(!table) return -1;
+
+    int status;
+    uintptr_t phys = platformGetPageEntry(table, index, &status);
     //KDEBUG("physical: 0x%08X  status: 0x%02X\n", phys, status);
 
-    // invalid page?
-    if(status & PLATFORM_PAGE_ERROR) return -1;
+    if((status & PLATFORM_PAGE_SWAP) && ((phys & VMM_PAGE_SWAP_MASK) == VMM_PAGE_GUARD)) {
+        KWARN("stack overflow: %s access to guard page at 0x%016X\n",
+            (access & VMM_PAGE_FAULT_USER) ? "user" : "kernel", addr);
+        return -1;
+    }
 
     // no exec perms and attempt to fetch?
     if(!(status & PLATFORM_PAGE_EXEC) && (access & VMM_PAGE_FAULT_FETCH)) return -1;
@@ -164,20 +271,30 @@ int vmmPageFault(uintptr_t addr, int access) {
             KERROR("TODO: page swapping is not implemented yet; returning failure for now\n");
             break;
         case VMM_PAGE_ALLOCATE:
-            /* here we need to allocate a physical page */
-            phys = pmmAllocate();
+            /* here we need to allocate a physical page, honoring the cache
+             * colors assigned to the running process if any */
+            Process *p = platformGetProcess();
+            uint64_t colors = p ? p->colors : 0;
+            uintptr_t old = phys;
+            phys = pmmAllocateColor(colors);
             if(!phys) {
                 KERROR("ran out of physical memory while handling page fault\n");
                 break;
             }
 
-            // map the physical page and return
-            if(!platformMapPage(addr & ~(PAGE_SIZE-1), phys, status | PLATFORM_PAGE_PRESENT)) {
-                KERROR("could not map physical page 0x%08X to logical 0x%08X\n", phys, addr & ~(PAGE_SIZE-1));
+            // lazily allocated memory is always handed out zeroed, so clear
+            // the page before it becomes visible; the kernel may be bringing
+            // in the same page on another CPU to deliver a syscall's results,
+            // in which case the page it installed is kept
+            memset((void *)vmmMMIO(phys, true), 0, PAGE_SIZE);
+            if(!platformReplacePageEntry(table, index, old, status, phys, status | PLATFORM_PAGE_PRESENT)) {
+                pmmFree(phys);
+                returnValue = 0;
                 break;
             }
 
-            //KDEBUG("handled page fault; allocated physical 0x%08X to logical 0x%08X\n", phys, addr & ~(PAGE_SIZE-1));
+            //KDEBUG("handled page fault; allocated physical 0x%08X to logical 0x%08X\n", phys, page);
+            vmmFaultAround(table, index, page, status, colors);
             returnValue = 0;
             break;
         default:
@@ -192,6 +192,7 @@ int apMain() {
     writeCR0(readCR0() & ~CR0_NOT_WRITE_THROUGH);
     writeCR0(readCR0() & ~CR0_CACHE_DISABLE);
     writeCR0(readCR0() & ~CR0_WRITE_PROTECT);
+    patSetup();
 
     smpCPUInfoSetup();
 
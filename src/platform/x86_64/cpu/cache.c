@@ -0,0 +1,61 @@
+/*
+ * lux - a lightweight unix-like operating system
+ * Omar Elghoul, 2024
+ *
+ * Platform-Specific Code for x86_64
+ */
+
+#include <platform/platform.h>
+#include <platform/x86_64.h>
+#include <platform/mmap.h>
+
+/* platformCacheColors(): returns the number of page colors of the last-level
+ * cache, i.e. the number of pages that fit in one way of the cache; physical
+ * pages of different colors can never evict each other from the cache
+ * params: none
+ * returns: number of colors, one if the cache geometry is unknown
+ */
+
+int platformCacheColors() {
+    CPUIDRegisters regs;
+    uint32_t leaf;
+
+    // Intel exposes the cache geometry in leaf 4, and AMD exposes the same
+    // structure in leaf 0x8000001D with topology extensions
+    readCPUID(0, &regs);
+    if(regs.eax >= 4 && regs.ebx == 0x756E6547) {     // "Genu"ineIntel
+        leaf = 4;
+    } else {
+        readCPUID(0x80000000, &regs);
+        if(regs.eax < 0x8000001D) return 1;
+
+        readCPUID(0x80000001, &regs);
+        if(!(regs.ecx & (1 << 22))) return 1;       // topology extensions
+        leaf = 0x8000001D;
+    }
+
+    int highestLevel = 0;
+    uint64_t waySize = 0;
+
+    for(uint32_t i = 0; i < 16; i++) {
+        regs.ecx = i;
+        readCPUID(leaf, &regs);
+
+        int type = regs.eax & 0x1F;
+        if(!type) break;                    // no more caches
+        if(type == 2) continue;             // instruction cache
+
+        int level = (regs.eax >> 5) & 7;
+        if(level < highestLevel) continue;
+
+        uint64_t lineSize = (regs.ebx & 0xFFF) + 1;
+        uint64_t partitions = ((regs.ebx >> 12) & 0x3FF) + 1;
+        uint64_t sets = (uint64_t)regs.ecx + 1;
+
+        highestLevel = level;
+        waySize = lineSize * partitions * sets;
+    }
+
+    if(waySize < PAGE_SIZE) return 1;
+    return waySize / PAGE_SIZE;
+}
@@ -9,6 +9,7 @@
 #include <platform/exception.h>
 #include <platform/platform.h>
 #include <platform/lock.h>
+#include <platform/tss.h>
 #include <kernel/logger.h>
 #include <kernel/memory.h>
 #include <kernel/sched.h>
@@ -52,6 +53,7 @@ void installExceptions() {
     installInterrupt((uint64_t)&opcodeException, GDT_KERNEL_CODE, PRIVILEGE_KERNEL, INTERRUPT_TYPE_TRAP, 0x06);
     installInterrupt((uint64_t)&deviceException, GDT_KERNEL_CODE, PRIVILEGE_KERNEL, INTERRUPT_TYPE_TRAP, 0x07);
     installInterrupt((uint64_t)&doubleException, GDT_KERNEL_CODE, PRIVILEGE_KERNEL, INTERRUPT_TYPE_TRAP, 0x08);
+    idt[0x08].flags |= (TSS_IST_DOUBLE_FAULT & IDT_FLAGS_IST_MASK);
     installInterrupt((uint64_t)&tssException, GDT_KERNEL_CODE, PRIVILEGE_KERNEL, INTERRUPT_TYPE_TRAP, 0x0A);
     installInterrupt((uint64_t)&segmentException, GDT_KERNEL_CODE, PRIVILEGE_KERNEL, INTERRUPT_TYPE_TRAP, 0x0B);
     installInterrupt((uint64_t)&stackException, GDT_KERNEL_CODE, PRIVILEGE_KERNEL, INTERRUPT_TYPE_TRAP, 0x0C);
@@ -84,6 +86,15 @@ void exception(uint64_t number, uint64_t code, InterruptRegisters *r) {
         if(!vmmPageFault(addr, pfStatus)) return;
     }
 
+    if(number == 8) {
+        // double faults on a guard page are kernel stack overflows, because
+        // the page fault itself could not be delivered on the same stack
+        uintptr_t phys, addr = readCR2();
+        int status = vmmPageStatus(addr, &phys);
+        if((status & PLATFORM_PAGE_SWAP) && ((phys & VMM_PAGE_SWAP_MASK) == VMM_PAGE_GUARD))
+            KERROR("kernel stack overflow: access to guard page at 0x%016X\n", addr);
+    }
+
     // TODO: implement a separate kernel panic and userspace exception handling
     acquireLockBlocking(&lock);
     setScheduling(false);
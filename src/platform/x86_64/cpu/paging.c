@@ -9,12 +9,28 @@
 #include <stdint.h>
 #include <platform/x86_64.h>
 #include <platform/platform.h>
+#include <platform/context.h>
 #include <kernel/logger.h>
 #include <kernel/memory.h>
 #include <kernel/tty.h>
 
 static uint64_t *kernelPagingRoot;  // pml4 -- PHYSICAL ADDRESS
 
+/* patSetup(): programs the page attribute table of the running CPU so that
+ * write-combining mappings are available; this must be done on every CPU
+ * params: none
+ * returns: nothing
+ */
+
+void patSetup() {
+    CPUIDRegisters regs;
+    memset(&regs, 0, sizeof(CPUIDRegisters));
+    readCPUID(1, &regs);
+    if(!(regs.edx & (1 << 16))) return;     // no PAT, WC falls back to WB
+
+    writeMSR(MSR_PAT, PAT_VALUE);
+}
+
 /* platformPagingSetup(): sets up the kernel's paging structures
  * this is called by the virtual memory manager early in the boot process
  */
@@ -64,7 +80,9 @@ int platformPagingSetup() {
         }
     }
 
-    // load the new paging roots
+    // load the new paging roots, which also flushes any stale translations
+    // made with the old page attributes
+    patSetup();
     writeCR3((uint64_t)pml4);
 
     ttyRemapFramebuffer();
@@ -131,8 +149,74 @@ uintptr_t platformGetPage(int *flags, uintptr_t addr) {
     if(!(pdEntry & PT_PAGE_PRESENT)) return 0;
 
     uint64_t *pt = (uint64_t *)vmmMMIO((pdEntry & ~(PAGE_SIZE-1)), true);
-    uint64_t ptEntry = pt[ptIndex];
-    
+    return platformGetPageEntry(pt, ptIndex, flags) | offset;
+}
+
+/* getPageTable(): returns the lowest-level paging structure covering a
+ * logical address in any address space
+ * params: root - physical address of the PML4
+ * params: addr - logical address
+ * params: index - pointer to where to store the index of the address's entry
+ * returns: pointer to the page table, NULL if it is not present
+ */
+
+static void *getPageTable(uint64_t root, uintptr_t addr, int *index) {
+    if(addr >= KERNEL_BASE_ADDRESS && addr <= KERNEL_BASE_END) return NULL;
+
+    int pml4Index = (addr >> 39) & 511;
+    int pdpIndex = (addr >> 30) & 511;
+    int pdIndex = (addr >> 21) & 511;
+    *index = (addr >> 12) & 511;
+
+    uint64_t *pml4 = (uint64_t *)vmmMMIO(root & ~(PAGE_SIZE-1), true);
+    uint64_t pml4Entry = pml4[pml4Index];
+    if(!(pml4Entry & PT_PAGE_PRESENT)) return NULL;
+
+    uint64_t *pdp = (uint64_t *)vmmMMIO((pml4Entry & ~(PAGE_SIZE-1)), true);
+    uint64_t pdpEntry = pdp[pdpIndex];
+    if(!(pdpEntry & PT_PAGE_PRESENT)) return NULL;
+
+    uint64_t *pd = (uint64_t *)vmmMMIO((pdpEntry & ~(PAGE_SIZE-1)), true);
+    uint64_t pdEntry = pd[pdIndex];
+    if(!(pdEntry & PT_PAGE_PRESENT) || (pdEntry & PT_PAGE_SIZE_EXTENSION)) return NULL;
+
+    return (void *)vmmMMIO((pdEntry & ~(PAGE_SIZE-1)), true);
+}
+
+/* platformGetPageTable(): returns the lowest-level paging structure covering
+ * a logical address, allowing a range of neighbouring pages to be inspected
+ * and modified with a single page table walk
+ * params: addr - logical address
+ * params: index - pointer to where to store the index of the address's entry
+ * returns: pointer to the page table, NULL if it is not present
+ */
+
+void *platformGetPageTable(uintptr_t addr, int *index) {
+    return getPageTable(readCR3(), addr, index);
+}
+
+/* platformGetContextPageTable(): same as above, but in the address space of
+ * a thread that may not be running, without switching to its paging context
+ * params: context - thread context
+ * params: addr - logical address
+ * params: index - pointer to where to store the index of the address's entry
+ * returns: pointer to the page table, NULL if it is not present
+ */
+
+void *platformGetContextPageTable(void *context, uintptr_t addr, int *index) {
+    ThreadContext *ctx = (ThreadContext *) context;
+    return getPageTable(ctx->cr3, addr, index);
+}
+
+/* decodePageEntry(): decodes the value of a page table entry
+ * params: ptEntry - raw entry
+ * params: flags - pointer to where to store the flags
+ * returns: physical address of the page
+ */
+
+static uintptr_t decodePageEntry(uint64_t ptEntry, int *flags) {
+    *flags = 0;
+
     if(ptEntry & PT_PAGE_PRESENT) *flags |= PLATFORM_PAGE_PRESENT;
     else if(ptEntry) *flags |= PLATFORM_PAGE_SWAP;  // not present in main memory but non-zero
 
@@ -140,8 +224,96 @@ uintptr_t platformGetPage(int *flags, uintptr_t addr) {
     if(ptEntry & PT_PAGE_USER) *flags |= PLATFORM_PAGE_USER;
     if(!(ptEntry & PT_PAGE_NXE)) *flags |= PLATFORM_PAGE_EXEC;
     if(ptEntry & PT_PAGE_NO_CACHE) *flags |= PLATFORM_PAGE_NO_CACHE;
-    
-    return (ptEntry & ~(PAGE_SIZE-1) & ~(PT_PAGE_NXE)) | offset;
+    else if(ptEntry & PT_PAGE_PAT) *flags |= PLATFORM_PAGE_WRITE_COMBINE;
+    else if(ptEntry & PT_PAGE_WRITE_THROUGH) *flags |= PLATFORM_PAGE_WRITE_THROUGH;
+    if(ptEntry & PT_PAGE_SHARED) *flags |= PLATFORM_PAGE_SHARED;
+
+    return ptEntry & ~(PAGE_SIZE-1) & ~(PT_PAGE_NXE);
+}
+
+/* encodePageEntry(): encodes the value of a page table entry
+ * params: physical - physical address, page-aligned
+ * params: flags - page flags requested
+ * returns: raw entry
+ */
+
+static uint64_t encodePageEntry(uintptr_t physical, int flags) {
+    uint64_t parsedFlags = 0;
+
+    if(flags & PLATFORM_PAGE_PRESENT) parsedFlags |= PT_PAGE_PRESENT;
+    if(flags & PLATFORM_PAGE_WRITE) parsedFlags |= PT_PAGE_RW;
+    if(flags & PLATFORM_PAGE_USER) parsedFlags |= PT_PAGE_USER;
+    if(!(flags & PLATFORM_PAGE_EXEC)) parsedFlags |= PT_PAGE_NXE;
+    // cache types are selected through the page attribute table, see patSetup()
+    if(flags & PLATFORM_PAGE_NO_CACHE) parsedFlags |= PT_PAGE_NO_CACHE | PT_PAGE_WRITE_THROUGH;
+    else if(flags & PLATFORM_PAGE_WRITE_COMBINE) parsedFlags |= PT_PAGE_PAT;
+    else if(flags & PLATFORM_PAGE_WRITE_THROUGH) parsedFlags |= PT_PAGE_WRITE_THROUGH;
+    if(flags & PLATFORM_PAGE_SHARED) parsedFlags |= PT_PAGE_SHARED;
+
+    return (physical & ~(PAGE_SIZE-1)) | parsedFlags;
+}
+
+/* platformGetPageEntry(): decodes an entry of a page table
+ * params: table - page table returned by platformGetPageTable()
+ * params: index - index of the entry
+ * params: flags - pointer to where to store the flags
+ * returns: physical address of the page
+ */
+
+uintptr_t platformGetPageEntry(void *table, int index, int *flags) {
+    return decodePageEntry(((uint64_t *)table)[index], flags);
+}
+
+/* platformSetPageEntry(): encodes an entry of a page table
+ * params: table - page table returned by platformGetPageTable()
+ * params: index - index of the entry
+ * params: physical - physical address, page-aligned
+ * params: flags - page flags requested
+ * returns: nothing
+ */
+
+void platformSetPageEntry(void *table, int index, uintptr_t physical, int flags) {
+    ((uint64_t *)table)[index] = encodePageEntry(physical, flags);
+}
+
+/* platformReplacePageEntry(): atomically changes an entry of a page table if
+ * it still holds what the caller read from it, so that two CPUs filling in
+ * the same entry can't overwrite each other
+ * params: table - page table returned by platformGetPageTable()
+ * params: index - index of the entry
+ * params: oldPhysical - physical address returned by platformGetPageEntry()
+ * params: oldFlags - flags returned by platformGetPageEntry()
+ * params: physical - new physical address, page-aligned
+ * params: flags - new page flags
+ * returns: true if the entry was changed, false if it changed under the caller
+ */
+
+bool platformReplacePageEntry(void *table, int index, uintptr_t oldPhysical, int oldFlags, uintptr_t physical, int flags) {
+    uint64_t *entry = &((uint64_t *)table)[index];
+    uint64_t old = __atomic_load_n(entry, __ATOMIC_ACQUIRE);
+    uint64_t new = encodePageEntry(physical, flags);
+
+    // the CPU may set the accessed and dirty bits at any time, which doesn't
+    // count as a change
+    for(;;) {
+        int f;
+        if((decodePageEntry(old, &f) != oldPhysical) || (f != oldFlags)) return false;
+        if(__atomic_compare_exchange_n(entry, &old, new, false, __ATOMIC_SEQ_CST, __ATOMIC_ACQUIRE))
+            return true;
+    }
+}
+
+/* platformInvalidatePage(): flushes the translation of a page whose entry
+ * was changed from present to something else, if the address space it
+ * belongs to is loaded on this CPU
+ * params: context - thread context owning the address space
+ * params: addr - logical address
+ * returns: nothing
+ */
+
+void platformInvalidatePage(void *context, uintptr_t addr) {
+    ThreadContext *ctx = (ThreadContext *) context;
+    if((readCR3() & ~(PAGE_SIZE-1)) == (ctx->cr3 & ~(PAGE_SIZE-1))) flushTLB(addr);
 }
 
 /* platformMapPage(): maps a physical address to a logical address
@@ -204,15 +376,7 @@ uintptr_t platformMapPage(uintptr_t logical, uintptr_t physical, int flags) {
     }
 
     uint64_t *pt = (uint64_t *)vmmMMIO((pdEntry & ~(PAGE_SIZE-1)), true);
-    uint64_t parsedFlags = 0;
-
-    if(flags & PLATFORM_PAGE_PRESENT) parsedFlags |= PT_PAGE_PRESENT;
-    if(flags & PLATFORM_PAGE_WRITE) parsedFlags |= PT_PAGE_RW;
-    if(flags & PLATFORM_PAGE_USER) parsedFlags |= PT_PAGE_USER;
-    if(!(flags & PLATFORM_PAGE_EXEC)) parsedFlags |= PT_PAGE_NXE;
-    if(flags & PLATFORM_PAGE_NO_CACHE) parsedFlags |= PT_PAGE_NO_CACHE | PT_PAGE_WRITE_THROUGH;
-
-    pt[ptIndex] = physical | parsedFlags;
+    platformSetPageEntry(pt, ptIndex, physical, flags);
 
     // maintain canonical addresses
     if(logical & ((uint64_t)1 << 47)) return logical | 0xFFF0000000000000;
@@ -259,7 +423,7 @@ uint64_t clonePagingLayer(uint64_t ptr, int layer) {
                 oldPhys = parent[i] & ~((PAGE_SIZE-1) | PT_PAGE_NXE);
                 memcpy((void *)vmmMMIO(newPhys, true), (const void *)vmmMMIO(oldPhys, true), PAGE_SIZE);
 
-                clone[i] = newPhys | (parent[i] & ((uint64_t)PT_PAGE_LOW_FLAGS | PT_PAGE_NXE));   // copy the parent's permissions
+                clone[i] = newPhys | (parent[i] & ((uint64_t)PT_PAGE_LOW_FLAGS | PT_PAGE_PAT | PT_PAGE_NXE));   // copy the parent's permissions
             } else {
                 // here we're working with either the PDP or PD that is also present
                 newPhys = pmmAllocate();
@@ -269,6 +433,10 @@ uint64_t clonePagingLayer(uint64_t ptr, int layer) {
                 clone[i] = clonePagingLayer(oldPhys, layer+1);
                 clone[i] |= parent[i] & PT_PAGE_LOW_FLAGS;  // copy permissions again
             }
+        } else if(layer == 2) {
+            // pages that are not present yet keep their markers, so lazily
+            // allocated memory and guard pages behave the same in the child
+            clone[i] = parent[i];
         } else {
             clone[i] = 0;
         }
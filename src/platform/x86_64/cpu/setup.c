@@ -73,10 +73,19 @@ int platformCPUSetup() {
     writeCR0(readCR0() & ~CR0_CACHE_DISABLE);
     writeCR0(readCR0() & ~CR0_WRITE_PROTECT);
 
+    // select the fastest string instructions for memcpy() and memset()
+    CPUIDRegisters regs;
+    readCPUID(0, &regs);
+    if(regs.eax >= 7) {
+        regs.ecx = 0;
+        readCPUID(7, &regs);
+        if(regs.ebx & CPUID_LEAF7_EBX_ERMS) stringFeatures |= STRING_ERMS;
+        if(regs.edx & CPUID_LEAF7_EDX_FSRM) stringFeatures |= STRING_FSRM;
+    }
+
     // read the CPU model
     memset(_model, 0, 49);
     uint32_t *ptr = (uint32_t *) _model;
-    CPUIDRegisters regs;
     readCPUID(0x80000000, &regs);
 
     if(regs.eax < 0x80000004) {
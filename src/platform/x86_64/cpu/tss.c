@@ -48,6 +48,16 @@ void tssSetup() {
         tss->ist[i] = (uint64_t)stack + KENREL_STACK_SIZE-16;
     }
 
+    // double faults get a stack of their own, so that overflowing a kernel
+    // stack into its guard page can still be reported
+    stack = calloc(1, KENREL_STACK_SIZE/2);
+    if(!stack) {
+        KERROR("failed to allocate memory for double fault stack\n");
+        while(1);
+    }
+
+    tss->ist[TSS_IST_DOUBLE_FAULT-1] = (uint64_t)stack + (KENREL_STACK_SIZE/2)-16;
+
     // I/O port privileges
     tss->iomap = 0x68;                  // offset from TSS start address
     memset(tss->ioports, 0xFF, 8192);   // deny I/O port access by default
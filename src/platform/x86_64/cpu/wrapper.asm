@@ -38,6 +38,12 @@ writeCR3:
     mov cr3, rdi
     ret
 
+global flushTLB
+align 16
+flushTLB:
+    invlpg [rdi]
+    ret
+
 global readCR4
 align 16
 readCR4:
@@ -10,6 +10,19 @@
 #include <stdint.h>
 #include <kernel/sched.h>
 
+/* I/O Port Permission Bitmap */
+
+/* one bitmap is shared by reference between all threads using it, including
+ * forked children, and is copied on write by ioperm() when it is shared with
+ * another process */
+
+typedef struct {
+    int references;
+    uint64_t version;       // unique for every modification
+    size_t length;          // number of bytes that may allow access to ports
+    uint8_t ports[8192];    // 0 = allowed, 1 = deny
+} IOPermissions;
+
 /* Thread Context for x86_64 */
 
 typedef struct {
@@ -44,16 +57,17 @@ typedef struct {
 
     ThreadGPR regs;         // register state
 
-    int iopl;               // set to 1 if I/O port privileges have been modified
-    uint8_t ioports[8192];  // I/O port privileges
+    IOPermissions *ioports; // I/O port privileges, NULL if none are allowed
 } __attribute__((packed)) ThreadContext;
 
-void *platformCreateContext(void *, int, uintptr_t, uintptr_t);
+void *platformCreateContext(void *, int, uintptr_t, uintptr_t, size_t);
 int platformSetContext(Thread *, uintptr_t, uintptr_t, const char **, const char **);
 int platformSignalSetup(Thread *);
+void platformIopermRelease(IOPermissions *);
 
 #define PLATFORM_CONTEXT_SIZE       sizeof(ThreadContext)
 
 #define PLATFORM_CONTEXT_KERNEL     0
 #define PLATFORM_CONTEXT_USER       1
-#define PLATFORM_THREAD_STACK       65536
+#define PLATFORM_THREAD_STACK       65536       // default kernel stack size
+#define PLATFORM_USER_STACK         0x100000    // default user stack size, backed on demand
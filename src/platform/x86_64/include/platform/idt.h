@@ -10,6 +10,7 @@
 #pragma once
 
 #define IDT_FLAGS_VALID                 0x8000
+#define IDT_FLAGS_IST_MASK              0x0007
 
 #define IDT_FLAGS_TYPE_INTERRUPT        0x0E
 #define IDT_FLAGS_TYPE_TRAP             0x0F
@@ -11,12 +11,15 @@
 
 // these constants must be defined for every CPU architecture
 #define PAGE_SIZE               4096                            // bytes
+#define PAGE_TABLE_ENTRIES      512                             // pages per lowest-level paging structure
 #define KERNEL_BASE_ADDRESS     (uintptr_t)0xFFFF800000000000
 #define KERNEL_MMIO_BASE        KERNEL_BASE_ADDRESS
 #define KERNEL_BASE_MAPPED      16                              // gigabytes to be mapped
 #define KERNEL_BASE_END         (KERNEL_BASE_ADDRESS-KERNEL_MMIO_LIMIT-1)
 #define KERNEL_HEAP_BASE        (uintptr_t)0xFFFF8F0000000000
-#define KERNEL_HEAP_LIMIT       (uintptr_t)0xFFFF8FFFFFFFFFFF
+#define KERNEL_HEAP_LIMIT       (uintptr_t)0xFFFF8F3FFFFFFFFF
+#define KERNEL_STACK_BASE       (uintptr_t)0xFFFF8F4000000000   // same top-level paging entry as the heap
+#define KERNEL_STACK_LIMIT      (uintptr_t)0xFFFF8F7FFFFFFFFF   // so it is shared by every address space
 #define KERNEL_MMIO_LIMIT       ((uint64_t)KERNEL_BASE_MAPPED << 30)
 #define USER_BASE_ADDRESS       0x400000                        // 4 MB, user programs will be loaded here
 #define USER_HEAP_BASE          (uintptr_t)0x00006FFF80000000   // for signal structures
@@ -42,6 +42,10 @@ typedef struct {
     IRQCommand *irqcmd;
 
     int cpuIndex;
+
+    // I/O port bitmap currently loaded in the TSS
+    uint64_t ioportsVersion;
+    size_t ioportsLength;
 } KernelCPUInfo;
 
 void smpCPUInfoSetup();
@@ -10,6 +10,7 @@
 #pragma once
 
 #define KENREL_STACK_SIZE           32768
+#define TSS_IST_DOUBLE_FAULT        1       // interrupt stack used for double faults
 
 typedef struct {
     uint32_t reserved1;
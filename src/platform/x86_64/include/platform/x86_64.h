@@ -49,6 +49,7 @@ void writeCR0(uint64_t);
 uint64_t readCR2();
 uint64_t readCR3();
 void writeCR3(uint64_t);
+void flushTLB(uintptr_t);
 uint64_t readCR4();
 void writeCR4(uint64_t);
 void loadGDT(void *);
@@ -70,6 +71,7 @@ void writeMSR(uint32_t, uint64_t);
 void enableIRQs();
 void disableIRQs();
 void halt();
+void patSetup();
 
 #define CR0_NOT_WRITE_THROUGH       0x20000000
 #define CR0_CACHE_DISABLE           0x40000000  // caching
@@ -77,6 +79,15 @@ void halt();
 
 #define CR4_FSGSBASE                0x00010000  // enable fs/gs segmentation
 
+// string instruction features used by memcpy() and memset() in string.asm
+#define CPUID_LEAF7_EBX_ERMS        0x00000200  // enhanced rep movsb/stosb
+#define CPUID_LEAF7_EDX_FSRM        0x00000010  // fast short rep movsb
+
+#define STRING_ERMS                 0x01
+#define STRING_FSRM                 0x02
+
+extern uint64_t stringFeatures;
+
 // other x86_64-specific routines
 extern GDTEntry gdt[];
 extern IDTEntry idt[];
@@ -98,6 +109,11 @@ void installInterrupt(uint64_t, uint16_t, int, int, int);
 #define MSR_LSTAR               0xC0000082  // syscall 64-bit entry point
 #define MSR_CSTAR               0xC0000083  // syscall 32-bit entry point, probably never gonna use this
 #define MSR_SFMASK              0xC0000084  // 32-bit EFLAGS mask, upper 32 bits reserved
+#define MSR_PAT                 0x00000277  // page attribute table
+
+// the PAT is the power-on default except that entry 4, which is selected by
+// the PAT bit alone, is write-combining instead of write-back
+#define PAT_VALUE               0x0007040100070406
 
 #define MSR_EFER_SYSCALL        0x00000001  // syscall/sysret instructions
 #define MSR_EFER_NX_ENABLE      0x00000800  // PAE/NX
@@ -110,8 +126,10 @@ void installInterrupt(uint64_t, uint16_t, int, int, int);
 #define PT_PAGE_WRITE_THROUGH   0x0008
 #define PT_PAGE_NO_CACHE        0x0010
 #define PT_PAGE_SIZE_EXTENSION  0x0080
+#define PT_PAGE_SHARED          0x0200      // available to software, see PLATFORM_PAGE_SHARED
+#define PT_PAGE_PAT             0x0080      // in page tables only, same bit as the size extension
 #define PT_PAGE_NXE             ((uint64_t)0x8000000000000000)   // SET to disable execution privilege
-#define PT_PAGE_LOW_FLAGS       (PT_PAGE_PRESENT | PT_PAGE_RW | PT_PAGE_USER | PT_PAGE_NO_CACHE)
+#define PT_PAGE_LOW_FLAGS       (PT_PAGE_PRESENT | PT_PAGE_RW | PT_PAGE_USER | PT_PAGE_WRITE_THROUGH | PT_PAGE_NO_CACHE)
 
 // page fault status code
 #define PF_PRESENT              0x01
@@ -8,8 +8,23 @@
 #include <platform/context.h>
 #include <kernel/sched.h>
 #include <errno.h>
+#include <stdlib.h>
+#include <string.h>
 
-/* platformIoperm(): sets the I/O permissions for the current thread
+// every modification of a bitmap gets a new version so that the context
+// switch can tell whether the bitmap loaded in the TSS is still current
+static uint64_t ioportsVersion = 0;
+
+/* platformIopermRelease(): releases a reference to an I/O port bitmap
+ * params: io - I/O port bitmap
+ * returns: nothing
+ */
+
+void platformIopermRelease(IOPermissions *io) {
+    if(!__atomic_sub_fetch(&io->references, 1, __ATOMIC_SEQ_CST)) free(io);
+}
+
+/* platformIoperm(): sets the I/O permissions for the current process
  * params: t - calling thread
  * params: from - base I/O port
  * params: count - number of I/O ports to change permissions
@@ -21,17 +36,67 @@ int platformIoperm(Thread *t, uintptr_t from, uintptr_t count, int enable) {
     // privilege checks were already performed in the generic ioperm()
     if((from+count-1) > 0xFFFF) return -EINVAL;     // 65536 I/O ports on x86
 
+    Process *p = getProcess(t->pid);
+    if(!p) return -ESRCH;
+
     ThreadContext *ctx = (ThreadContext *) t->context;
-    ctx->iopl = 1;
+    IOPermissions *io = ctx->ioports;
+
+    // the bitmap is owned by the process, so copy it if it is either missing
+    // or still shared with another process after fork()
+    int owners = 0;
+    for(int i = 0; io && i < p->threadCount; i++) {
+        if(p->threads[i] && ((ThreadContext *) p->threads[i]->context)->ioports == io)
+            owners++;
+    }
+
+    if(!io || io->references > owners) {
+        IOPermissions *copy = malloc(sizeof(IOPermissions));
+        if(!copy) return -ENOMEM;
 
-    for(int i = 0; i < count; i++) {
+        if(io) {
+            memcpy(copy->ports, io->ports, 8192);
+            copy->length = io->length;
+        } else {
+            memset(copy->ports, 0xFF, 8192);    // disable access by default
+            copy->length = 0;
+        }
+
+        copy->references = 0;
+
+        for(int i = 0; i < p->threadCount; i++) {
+            if(!p->threads[i]) continue;
+            ThreadContext *tctx = (ThreadContext *) p->threads[i]->context;
+            if(tctx->ioports != io) continue;
+
+            tctx->ioports = copy;
+            copy->references++;
+            if(io) platformIopermRelease(io);
+        }
+
+        if(!copy->references) {
+            // the calling thread is always part of the process
+            free(copy);
+            return -ESRCH;
+        }
+
+        io = copy;
+    }
+
+    for(uintptr_t i = 0; i < count; i++) {
         int byte = (from + i) / 8;
         int bit = (from + i) % 8;
 
-        if(enable) ctx->ioports[byte] &= ~(1 << bit);
-        else ctx->ioports[byte] |= (1 << bit);
+        if(enable) io->ports[byte] &= ~(1 << bit);
+        else io->ports[byte] |= (1 << bit);
     }
 
+    // track the highest byte that was ever changed so that the context switch
+    // only needs to copy that much into the TSS
+    size_t length = ((from + count - 1) / 8) + 1;
+    if(length > io->length) io->length = length;
+    io->version = __atomic_add_fetch(&ioportsVersion, 1, __ATOMIC_SEQ_CST);
+
     // new permissions will be enforced in the next context switch, so return
     return 0;
-}
\ No newline at end of file
+}
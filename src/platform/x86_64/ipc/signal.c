@@ -54,6 +54,7 @@ int platformSignalSetup(Thread *t) {
 
 int platformSendSignal(Thread *sender, Thread *dest, int signum, uintptr_t handler) {
     memcpy(dest->signalContext, dest->context, PLATFORM_CONTEXT_SIZE);
+    ((ThreadContext *) dest->signalContext)->ioports = NULL;
 
     ThreadContext *ctx = (ThreadContext *) dest->context;
     platformUseContext(ctx);
@@ -73,6 +74,7 @@ int platformSendSignal(Thread *sender, Thread *dest, int signum, uintptr_t handl
 
     ThreadContext *uctx = (ThreadContext *) dest->signalUserContext;
     memcpy(uctx, dest->context, PLATFORM_CONTEXT_SIZE);
+    uctx->ioports = NULL;   // kernel pointer, don't leak it to the handler
 
     // signal entry point
     // func(int sig, siginfo_t *info, void *ctx)
@@ -104,5 +106,10 @@ int platformSendSignal(Thread *sender, Thread *dest, int signum, uintptr_t handl
  */
 
 void platformSigreturn(Thread *t) {
+    // the I/O permissions are reference counted and may have been changed
+    // by the handler, so keep the live ones rather than the saved copy
+    ThreadContext *ctx = (ThreadContext *) t->context;
+    IOPermissions *io = ctx->ioports;
     memcpy(t->context, t->signalContext, PLATFORM_CONTEXT_SIZE);
+    ctx->ioports = io;
 }
\ No newline at end of file
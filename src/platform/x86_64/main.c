@@ -48,6 +48,7 @@ int platformMain(KernelBootInfo *k) {
     installExceptions();
     pmmInit(&boot);
     vmmInit();
+    dmaInit();
 
     ttyCreateBackbuffer();
     acpiInit(&boot);
@@ -20,6 +20,9 @@
 #include <kernel/sched.h>
 #include <kernel/memory.h>
 #include <kernel/syscalls.h>
+#include <platform/lock.h>
+
+static lock_t stackLock = LOCK_INITIAL;
 
 /* platformGetPid(): returns the PID of the process running on the current CPU
  * params: none
@@ -70,10 +73,11 @@ Thread *platformGetThread() {
  * params: level - kernel/user space
  * params: entry - entry point of the thread
  * params: arg - argument to be passed to the thread
+ * params: stackSize - size of kernel stacks, zero for the default
  * returns: pointer to the context structure, NULL on failure
  */
 
-void *platformCreateContext(void *ptr, int level, uintptr_t entry, uintptr_t arg) {
+void *platformCreateContext(void *ptr, int level, uintptr_t entry, uintptr_t arg, size_t stackSize) {
     memset(ptr, 0, PLATFORM_CONTEXT_SIZE);
 
     ThreadContext *context = (ThreadContext *)ptr;
@@ -84,14 +88,24 @@ void *platformCreateContext(void *ptr, int level, uintptr_t entry, uintptr_t arg
     //if(!context->cr3) return NULL;
     void *stack;
 
-    memset(context->ioports, 0xFF, 8192);   // disable I/O port access by default
-
     if(level == PLATFORM_CONTEXT_KERNEL) {
         context->regs.cs = GDT_KERNEL_CODE << 3;
         context->regs.ss = GDT_KERNEL_DATA << 3;
-        stack = calloc(1, PLATFORM_THREAD_STACK);
+
+        // kernel stacks can't be backed on demand because page faults are
+        // handled on the same stack, but they do get a guard page below them
+        if(!stackSize) stackSize = PLATFORM_THREAD_STACK;
+        size_t pages = (stackSize + PAGE_SIZE - 1) / PAGE_SIZE;
+
+        acquireLockBlocking(&stackLock);
+        stack = (void *) vmmAllocate(KERNEL_STACK_BASE, KERNEL_STACK_LIMIT, pages+1, VMM_WRITE);
+        if(stack) vmmGuard((uintptr_t) stack, 1);
+        releaseLock(&stackLock);
+
         if(!stack) return NULL;
-        context->regs.rsp = (uint64_t)stack + PLATFORM_THREAD_STACK;
+        stack = (void *)((uintptr_t) stack + PAGE_SIZE);
+        memset(stack, 0, pages * PAGE_SIZE);
+        context->regs.rsp = (uint64_t)stack + (pages * PAGE_SIZE);
 
         // TODO: handle implicit thread termination by returning
         // to do so we would need to push a return function to the thread's stack
@@ -125,13 +139,19 @@ void platformSwitchContext(Thread *t) {
         ctx->regs.rflags |= 0x202;
     }
 
-    // modify the TSS with the current thread's I/O permissions if necessary
-    Thread *old = kinfo->thread;
-    ThreadContext *oldctx = NULL;
-    if(old) oldctx = (ThreadContext *) old->context;
-
-    if(ctx->iopl || (oldctx && oldctx->iopl)) {
-        memcpy(kinfo->tss->ioports, ctx->ioports, 8192);
+    // modify the TSS with the current thread's I/O permissions if they are
+    // not already loaded, and only rewrite the part of the bitmap that either
+    // the outgoing or the incoming permissions actually touched
+    IOPermissions *io = ctx->ioports;
+    uint64_t version = io ? io->version : 0;
+    if(version != kinfo->ioportsVersion) {
+        size_t length = io ? io->length : 0;
+        if(length) memcpy(kinfo->tss->ioports, io->ports, length);
+        if(kinfo->ioportsLength > length)
+            memset(&kinfo->tss->ioports[length], 0xFF, kinfo->ioportsLength - length);
+
+        kinfo->ioportsVersion = version;
+        kinfo->ioportsLength = length;
     }
 
     kinfo->thread = t;
@@ -178,60 +198,64 @@ int platformSetContext(Thread *t, uintptr_t entry, uintptr_t highest, const char
 
     base += PAGE_SIZE;      // guard page
 
-    // parse args
+    // the strings and the pointer arrays are packed together at the top of
+    // the stack like on other unix-like systems, so that the cost of spawning
+    // a program scales with the size of its arguments and not their count
+    int argc = 0, envc = 0;
+    size_t size = 0;
     if(argv) {
-        int argc;
-        for(argc = 0; argv[argc]; argc++);
-
-        uintptr_t *args = (uintptr_t *) vmmAllocate(base, USER_LIMIT_ADDRESS, 1, VMM_WRITE | VMM_USER);
-        if(!args) return -1;
-
-        ctx->regs.rdi = (uint64_t) args;
-
-        // copy args
-        for(int i = 0; argc && i < argc; i++) {
-            args[i] = vmmAllocate(base, USER_LIMIT_ADDRESS, 1, VMM_WRITE | VMM_USER);
-            if(!args[i]) return -1;
-            strcpy((char *) args[i], argv[i]);
-        }
-
-        // and null terminate
-        args[argc] = 0;
+        for(; argv[argc]; argc++) size += strlen(argv[argc]) + 1;
     }
 
-    // likewise for the env variables
     if(envp) {
-        int envc;
-        for(envc = 0; envp[envc]; envc++);
+        for(; envp[envc]; envc++) size += strlen(envp[envc]) + 1;
+    }
 
-        uintptr_t *envs = (uintptr_t *) vmmAllocate(base, USER_LIMIT_ADDRESS, 1, VMM_WRITE | VMM_USER);
-        if(!envs) return -1;
+    size = (size + 15) & ~15;
+    size += (argc + envc + 2) * sizeof(uintptr_t);
 
-        ctx->regs.rsi = (uint64_t) envs;
+    // the stack is not touched here, so its pages are only allocated when
+    // they are first used, and the page below it is a guard page
+    size_t stackSize = t->stackSize ? t->stackSize : PLATFORM_USER_STACK;
+    size_t argPages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    size_t pages = (stackSize+PAGE_SIZE-1)/PAGE_SIZE;
+    pages += argPages;
 
-        // copy env variables
-        for(int i = 0; envc && i < envc; i++) {
-            envs[i] = vmmAllocate(base, USER_LIMIT_ADDRESS, 1, VMM_WRITE | VMM_USER);
-            if(!envs[i]) return -1;
-            strcpy((void *) envs[i], envp[i]);
-        }
+    uintptr_t stack = vmmAllocate(base, USER_LIMIT_ADDRESS, pages+1, VMM_WRITE | VMM_USER);
+    if(!stack) return -1;
+    if(vmmGuard(stack, 1)) return -1;
+    stack += PAGE_SIZE;
+
+    uintptr_t top = stack + (pages * PAGE_SIZE);
+    uintptr_t *args = (uintptr_t *) (top - size);
+    uintptr_t *envs = args + argc + 1;
+    char *strings = (char *) (envs + envc + 1);
+
+    for(int i = 0; i < argc; i++) {
+        size_t length = strlen(argv[i]) + 1;
+        args[i] = (uintptr_t) strings;
+        memcpy(strings, argv[i], length);
+        strings += length;
+    }
 
-        // and null terminate
-        envs[envc] = 0;
+    for(int i = 0; i < envc; i++) {
+        size_t length = strlen(envp[i]) + 1;
+        envs[i] = (uintptr_t) strings;
+        memcpy(strings, envp[i], length);
+        strings += length;
     }
 
-    // now allocate a stack
-    size_t pages = (PLATFORM_THREAD_STACK+PAGE_SIZE-1)/PAGE_SIZE;
-    pages++;
+    // and null terminate
+    args[argc] = 0;
+    envs[envc] = 0;
 
-    uintptr_t stack = vmmAllocate(base, USER_LIMIT_ADDRESS, pages, VMM_WRITE | VMM_USER);
-    if(!stack) return -1;
-    memset((void *)stack, 0, PLATFORM_THREAD_STACK + PAGE_SIZE);
+    if(argv) ctx->regs.rdi = (uint64_t) args;
+    if(envp) ctx->regs.rsi = (uint64_t) envs;
 
-    stack += PLATFORM_THREAD_STACK;
-    ctx->regs.rsp = stack;
+    // the stack grows down from right below the arguments
+    ctx->regs.rsp = (uintptr_t) args & ~15;
 
-    t->highest = stack + PAGE_SIZE;     // requisite to sbrk()
+    t->highest = top;       // requisite to sbrk()
 
     t->pages = (t->highest - USER_BASE_ADDRESS + PAGE_SIZE - 1) / PAGE_SIZE;
     return 0;
@@ -281,7 +305,13 @@ void *platformCloneContext(void *cctx, const void *pctx) {
     // the kernel is always present in the higher half of every address space
     // and is unchanging, so it doesn't need cloning
     child->cr3 = (uint64_t)platformCloneUserSpace(parent->cr3);
-    if(!child->cr3) return NULL;
+    if(!child->cr3) {
+        child->ioports = NULL;
+        return NULL;
+    }
+
+    // the I/O port bitmap is shared until either process modifies it
+    if(child->ioports) __atomic_add_fetch(&child->ioports->references, 1, __ATOMIC_SEQ_CST);
     return child;
 }
 
@@ -310,53 +340,115 @@ void setLocalSched(bool sched) {
     else disableIRQs();
 }
 
-/* freePT(): frees a page table
- * params: base - base pointer to the page table
- * params: depth - 0 for PML4, 1 for PDP, 2 for PD, 3 for PT
- * params: maxdepth - depth to stop recursing at
- * returns: nothing
+/* platformDetachContext(): detaches the address space from a thread context
+ * so that it can be freed later, possibly by another thread
+ * params: ptr - pointer to thread context
+ * returns: handle to the address space for platformReclaimSpace(), zero if none
  */
 
-void freePT(uint64_t *base, int depth, int maxdepth) {
-    if(depth < 0 || depth > maxdepth) return;
+uintptr_t platformDetachContext(void *ptr) {
+    if(!ptr) return 0;
+    ThreadContext *ctx = ptr;
+    if(ctx->ioports) {
+        platformIopermRelease(ctx->ioports);
+        ctx->ioports = NULL;
+    }
+
+    uintptr_t root = ctx->cr3;
+    ctx->cr3 = 0;
+    return root;
+}
+
+/* platformReclaimSpace(): frees part of a detached address space, one page
+ * table at a time so that the work can be spread out
+ * params: root - handle returned by platformDetachContext()
+ * params: cursor - logical address to resume at, zero to start, updated
+ * params: budget - approximate number of pages to free before returning
+ * returns: one when the address space has been completely freed, zero if not
+ */
 
-    PhysicalMemoryStatus st;
-    pmmStatus(&st);
+int platformReclaimSpace(uintptr_t root, uintptr_t *cursor, int budget) {
+    const uintptr_t end = (uintptr_t)256 << 39;     // lower half only
+    uint64_t *pml4 = (uint64_t *) vmmMMIO(root & ~(PAGE_SIZE-1), true);
+    uintptr_t frames[512];
+    uintptr_t addr = *cursor;
+
+    while((addr < end) && (budget > 0)) {
+        int pml4Index = (addr >> 39) & 511;
+        int pdpIndex = (addr >> 30) & 511;
+        int pdIndex = (addr >> 21) & 511;
+        budget--;
+
+        if(!(pml4[pml4Index] & PT_PAGE_PRESENT)) {
+            addr = (addr | (((uintptr_t)1 << 39) - 1)) + 1;
+            continue;
+        }
 
-    for(int i = 0; i < 512; i++) {
-        uint64_t entry = base[i];
-        uint64_t phys = entry & ~((PAGE_SIZE-1) | PT_PAGE_NXE);
-        if((entry & PT_PAGE_PRESENT) && (phys) && (phys < st.highestUsableAddress)) {
-            if(depth < maxdepth)
-                freePT((uint64_t *) vmmMMIO(phys, true), depth+1, maxdepth);
+        uint64_t *pdp = (uint64_t *) vmmMMIO(pml4[pml4Index] & ~((PAGE_SIZE-1) | PT_PAGE_NXE), true);
+        if(pdp[pdpIndex] & PT_PAGE_PRESENT) {
+            uint64_t *pd = (uint64_t *) vmmMMIO(pdp[pdpIndex] & ~((PAGE_SIZE-1) | PT_PAGE_NXE), true);
+            if((pd[pdIndex] & PT_PAGE_PRESENT) && !(pd[pdIndex] & PT_PAGE_SIZE_EXTENSION)) {
+                uintptr_t table = pd[pdIndex] & ~((PAGE_SIZE-1) | PT_PAGE_NXE);
+                uint64_t *pt = (uint64_t *) vmmMMIO(table, true);
+
+                // free all the pages of this table in one batch, except for
+                // the ones the kernel owns and frees on its own
+                int count = 0;
+                for(int i = 0; i < 512; i++) {
+                    if((pt[i] & PT_PAGE_PRESENT) && !(pt[i] & PT_PAGE_SHARED))
+                        frames[count++] = pt[i] & ~((PAGE_SIZE-1) | PT_PAGE_NXE);
+                }
+
+                pmmFreeBatch(frames, count);
+                pmmFree(table);
+                pd[pdIndex] = 0;
+                budget -= count;
+            }
+
+            addr = (addr | (((uintptr_t)1 << 21) - 1)) + 1;
+            if(!(addr & (((uintptr_t)1 << 30) - 1))) {
+                // done with this page directory
+                pmmFree(pdp[pdpIndex] & ~((PAGE_SIZE-1) | PT_PAGE_NXE));
+                pdp[pdpIndex] = 0;
+            }
+        } else {
+            addr = (addr | (((uintptr_t)1 << 30) - 1)) + 1;
+        }
 
-            pmmFree(phys);
+        if(!(addr & (((uintptr_t)1 << 39) - 1))) {
+            // done with this page directory pointer table
+            pmmFree(pml4[pml4Index] & ~((PAGE_SIZE-1) | PT_PAGE_NXE));
+            pml4[pml4Index] = 0;
         }
     }
+
+    *cursor = addr;
+    if(addr < end) return 0;
+
+    pmmFree(root & ~(PAGE_SIZE-1));
+    return 1;
 }
 
 /* platformCleanThread(): cleans up the memory space used by a thread after it
- * is no longer running
+ * is no longer running, synchronously
  * params: ptr - pointer to thread context
  * params: highest - highest memory address used by thread
  * returns: nothing
  */
 
 void platformCleanThread(void *ptr, uintptr_t highest) {
-    if(!ptr || highest <= USER_BASE_ADDRESS+PAGE_SIZE) return;
+    if(!ptr) return;
     ThreadContext *ctx = ptr;
-    if(!ctx->cr3) return;
-    
-    // free the page tables themselves and all associated physical mem
-    //uint64_t saved = readCR3();
-    //writeCR3(ctx->cr3);
-    //vmmFree(USER_BASE_ADDRESS, (highest-USER_BASE_ADDRESS) / PAGE_SIZE);
-    //writeCR3(saved);
-
-    uint64_t *pml4 = (uint64_t *) vmmMMIO(ctx->cr3, true);
-    for(int i = 0; i < 256; i++) {
-        freePT((uint64_t *) vmmMMIO(pml4[i] & ~(PAGE_SIZE-1), true), 1, 3);
+    if(ctx->ioports) {
+        platformIopermRelease(ctx->ioports);
+        ctx->ioports = NULL;
     }
 
-    pmmFree(ctx->cr3);
+    if(highest <= USER_BASE_ADDRESS+PAGE_SIZE) return;
+
+    uintptr_t root = platformDetachContext(ctx);
+    if(!root) return;
+
+    uintptr_t cursor = 0;
+    while(!platformReclaimSpace(root, &cursor, PAGE_TABLE_ENTRIES));
 }
@@ -4,6 +4,20 @@
 
 [bits 64]
 
+; string instruction features, detected at boot in platformCPUSetup()
+STRING_ERMS                 equ 0x01    ; enhanced rep movsb/stosb
+STRING_FSRM                 equ 0x02    ; fast short rep movsb
+
+STRING_SMALL                equ 64      ; below this, avoid rep startup cost
+STRING_ERMS_THRESHOLD       equ 128     ; rep movsb beats rep movsq above this with ERMS
+STRING_NON_TEMPORAL         equ 0x200000    ; copies this large bypass the cache
+
+section .data
+
+global stringFeatures
+align 8
+stringFeatures:             dq 0
+
 section .text
 
 ; void *memcpy(void *dst, const void *src, size_t n)
@@ -11,94 +25,223 @@ global memcpy
 align 16
 memcpy:
     mov rax, rdi        ; return value
+    mov rcx, rdx
 
-    cmp rdx, 8
-    jl .low
+    cmp rdx, STRING_NON_TEMPORAL
+    jae .non_temporal
 
-    mov rcx, rdx
+    test byte [rel stringFeatures], STRING_FSRM
+    jnz .bytes          ; rep movsb is fast for every size
+
+    cmp rdx, STRING_SMALL
+    jb .small
+
+    cmp rdx, STRING_ERMS_THRESHOLD
+    jb .qwords
+    test byte [rel stringFeatures], STRING_ERMS
+    jnz .bytes
+
+.qwords:
     shr rcx, 3          ; div 8
     rep movsq
+    mov rcx, rdx
+    and rcx, 7          ; mod 8
 
-    and rdx, 7          ; mod 8
+.bytes:
+    rep movsb
+    ret
 
-.low:
-    mov rcx, rdx
+.small:
+    cmp rcx, 8
+    jb .tiny
+
+    ; copy qwords and finish with the last qword of the buffer, which may
+    ; overlap the previous store
+    mov r9, [rsi+rcx-8]
+
+.small_loop:
+    mov r8, [rsi]
+    mov [rdi], r8
+    add rsi, 8
+    add rdi, 8
+    sub rcx, 8
+    cmp rcx, 8
+    jae .small_loop
+
+    mov [rax+rdx-8], r9
+    ret
+
+.tiny:
+    test rcx, rcx
+    jz .done
+
+.tiny_loop:
+    mov r8b, [rsi]
+    mov [rdi], r8b
+    inc rsi
+    inc rdi
+    dec rcx
+    jnz .tiny_loop
+
+.done:
+    ret
+
+.non_temporal:
+    ; large copies would only evict everything else from the cache, so use
+    ; non-temporal stores, starting at an aligned destination
+    mov rcx, rdi
+    neg rcx
+    and rcx, 7
+    sub rdx, rcx
     rep movsb
 
+    mov rcx, rdx
+    shr rcx, 5          ; div 32
+
+.non_temporal_loop:
+    mov r8, [rsi]
+    mov r9, [rsi+8]
+    mov r10, [rsi+16]
+    mov r11, [rsi+24]
+    movnti [rdi], r8
+    movnti [rdi+8], r9
+    movnti [rdi+16], r10
+    movnti [rdi+24], r11
+    add rsi, 32
+    add rdi, 32
+    dec rcx
+    jnz .non_temporal_loop
+
+    sfence              ; non-temporal stores are weakly ordered
+
+    mov rcx, rdx
+    and rcx, 31         ; mod 32
+    rep movsb
     ret
 
 ; void *memmove(void *dst, const void *src, size_t n)
 global memmove
 align 16
 memmove:
-    mov rax, rdi        ; return value
-
+    ; a forward copy is safe unless the destination starts inside the source
     mov r8, rdi
     sub r8, rsi         ; dst-src
-    pushfq
-    jns .check_overlap
-
-    not r8
-    inc r8
-
-.check_overlap:
     cmp r8, rdx
-    jge .memcpy
-
-    popfq
-    jns .backward        ; if dst>src copy backwards
+    jae memcpy          ; unsigned, so this includes dst < src
 
-.forward:
-    mov rcx, rdx
-    rep movsb
-
-    ret
+    mov rax, rdi        ; return value
+    test r8, r8
+    jz .done            ; dst == src
 
 .backward:
+    ; copy qwords from the end, then the remaining bytes at the start
     std
+    lea rsi, [rsi+rdx-8]
+    lea rdi, [rdi+rdx-8]
+    mov rcx, rdx
+    shr rcx, 3          ; div 8
+    rep movsq
+
+    add rsi, 7
+    add rdi, 7
     mov rcx, rdx
-    dec rdx
-    add rdi, rdx
-    add rsi, rdx
+    and rcx, 7          ; mod 8
     rep movsb
     cld
 
+.done:
     ret
 
-.memcpy:
-    popfq
-    jmp memcpy
-
 ; void *memset(void *dst, int val, size_t n)
 global memset
 align 16
 memset:
     mov r8, rdi         ; r8 = dst
+    mov rcx, rdx
 
-    and rsi, 0xFF
-    mov rax, rsi        ; low 8 bits
+    movzx eax, sil
+    mov r9, 0x0101010101010101
+    imul rax, r9        ; value repeated in all 8 bytes
 
-    cmp rdx, 8
-    jl .low
+    cmp rdx, STRING_NON_TEMPORAL
+    jae .non_temporal
 
-    shr rax, 8
-    or rax, rsi         ; 16 bits
-    mov si, ax
-    shr rax, 16
-    mov ax, si          ; 32 bits
-    mov esi, eax
-    shr rax, 32
-    or rax, rsi         ; full 64 bits
+    test byte [rel stringFeatures], STRING_FSRM
+    jnz .bytes
 
-    mov rcx, rdx
+    cmp rdx, STRING_SMALL
+    jb .small
+
+    cmp rdx, STRING_ERMS_THRESHOLD
+    jb .qwords
+    test byte [rel stringFeatures], STRING_ERMS
+    jnz .bytes
+
+.qwords:
     shr rcx, 3          ; div 8
     rep stosq
+    mov rcx, rdx
+    and rcx, 7          ; mod 8
+
+.bytes:
+    rep stosb
+    mov rax, r8         ; return value
+    ret
+
+.small:
+    cmp rcx, 8
+    jb .tiny
+
+    mov [rdi+rcx-8], rax    ; last qword, may overlap
+
+.small_loop:
+    mov [rdi], rax
+    add rdi, 8
+    sub rcx, 8
+    cmp rcx, 8
+    jae .small_loop
+
+    mov rax, r8
+    ret
+
+.tiny:
+    test rcx, rcx
+    jz .done
+
+.tiny_loop:
+    mov [rdi], al
+    inc rdi
+    dec rcx
+    jnz .tiny_loop
 
-    and rdx, 7          ; mod 8
+.done:
+    mov rax, r8
+    ret
+
+.non_temporal:
+    mov rcx, rdi
+    neg rcx
+    and rcx, 7
+    sub rdx, rcx
+    rep stosb
+
+    mov rcx, rdx
+    shr rcx, 5          ; div 32
+
+.non_temporal_loop:
+    movnti [rdi], rax
+    movnti [rdi+8], rax
+    movnti [rdi+16], rax
+    movnti [rdi+24], rax
+    add rdi, 32
+    dec rcx
+    jnz .non_temporal_loop
+
+    sfence
 
-.low:
     mov rcx, rdx
+    and rcx, 31         ; mod 32
     rep stosb
 
-    mov rax, r8         ; return value
+    mov rax, r8
     ret
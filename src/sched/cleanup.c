@@ -9,6 +9,84 @@
 #include <stdlib.h>
 #include <kernel/sched.h>
 #include <platform/platform.h>
+#include <platform/lock.h>
+
+/* address spaces are detached from their threads immediately, and then freed
+ * a batch at a time by the idle threads, so that neither the thread tearing
+ * down an address space nor the parent waiting for it pays for its size */
+
+typedef struct Reclaim {
+    struct Reclaim *next;
+    uintptr_t space;        // handle from platformDetachContext()
+    uintptr_t cursor;       // progress through the address space
+} Reclaim;
+
+static Reclaim *reclaimHead = NULL, *reclaimTail = NULL;
+static lock_t lock = LOCK_INITIAL;
+
+/* reclaimEnqueue(): adds an address space to the tail of the reclaim queue
+ * params: r - reclaim entry
+ * returns: nothing
+ */
+
+static void reclaimEnqueue(Reclaim *r) {
+    r->next = NULL;
+
+    acquireLockBlocking(&lock);
+    if(reclaimTail) reclaimTail->next = r;
+    else reclaimHead = r;
+    reclaimTail = r;
+    releaseLock(&lock);
+}
+
+/* reclaimContext(): detaches the address space of a thread context that will
+ * never run again and queues it to be freed in the background
+ * params: context - thread context
+ * returns: nothing
+ */
+
+void reclaimContext(void *context) {
+    uintptr_t space = platformDetachContext(context);
+    if(!space) return;
+
+    Reclaim *r = calloc(1, sizeof(Reclaim));
+    if(!r) {
+        // free it right away as a last resort
+        uintptr_t cursor = 0;
+        while(!platformReclaimSpace(space, &cursor, RECLAIM_BATCH));
+        return;
+    }
+
+    r->space = space;
+    reclaimEnqueue(r);
+}
+
+/* reclaimStep(): frees one batch of the address space at the head of the
+ * reclaim queue, this is called by the idle threads
+ * params: none
+ * returns: nonzero if there was any work to do
+ */
+
+int reclaimStep() {
+    if(!reclaimHead) return 0;
+
+    acquireLockBlocking(&lock);
+    Reclaim *r = reclaimHead;
+    if(r) {
+        reclaimHead = r->next;
+        if(!reclaimHead) reclaimTail = NULL;
+    }
+    releaseLock(&lock);
+
+    if(!r) return 0;
+
+    // the entry is owned by this thread until it is queued again, so other
+    // idle threads can work on other address spaces at the same time
+    if(platformReclaimSpace(r->space, &r->cursor, RECLAIM_BATCH)) free(r);
+    else reclaimEnqueue(r);
+
+    return 1;
+}
 
 /* threadCleanup(): frees all memory associated with a thread and removes it
  * from the run queues
@@ -17,7 +95,7 @@
  */
 
 void threadCleanup(Thread *t) {
-    platformCleanThread(t->context, t->highest);
+    reclaimContext(t->context);
 
     /* TODO: properly re-implement this after implementing per-CPU run queue */
-}
\ No newline at end of file
+}
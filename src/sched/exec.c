@@ -15,6 +15,10 @@
 #include <kernel/elf.h>
 #include <kernel/modules.h>
 #include <kernel/signal.h>
+#include <kernel/servers.h>
+#include <kernel/socket.h>
+#include <kernel/poll.h>
+#include <kernel/pipe.h>
 
 int execmve(Thread *, void *, const char **, const char **);
 
@@ -35,7 +39,7 @@ pid_t execveMemory(const void *ptr, const char **argv, const char **envp) {
     }
 
     Process *process = getProcess(pid);
-    strcpy(process->command, "lumen");
+    processRename(process, "lumen", "lumen");
 
     // this is a blank process, so we need to create a thread for it
     process->threadCount = 1;
@@ -68,7 +72,7 @@ pid_t execveMemory(const void *ptr, const char **argv, const char **envp) {
         return 0;
     }
 
-    if(!platformCreateContext(process->threads[0]->context, PLATFORM_CONTEXT_USER, 0, 0)) {
+    if(!platformCreateContext(process->threads[0]->context, PLATFORM_CONTEXT_USER, 0, 0, 0)) {
         free(process->threads[0]->context);
         free(process->threads[0]);
         free(process->threads);
@@ -188,22 +192,28 @@ int execveHandle(void *msg) {
 
     if(!argv || !envp) return -ENOMEM;
 
-    memset(p->command, 0, ARG_MAX);
-
+    // the command line is the arguments separated by spaces
+    size_t commandLength = 1;
     for(int i = 0; argc && (i < argc); i++) {
         argv[i] = malloc(strlen(argvSrc[i]) + 1);
         if(!argv[i]) return -ENOMEM;
 
         strcpy(argv[i], argvSrc[i]);
-        if(i == 0) {
-            strcpy(p->name, argvSrc[0]);
-            strcpy(p->command, argvSrc[0]);
-        } else {
-            strcpy(p->command + strlen(p->command), " ");
-            strcpy(p->command + strlen(p->command), argvSrc[i]);
-        }
+        commandLength += strlen(argv[i]) + 1;
+    }
+
+    char *command = malloc(commandLength);
+    if(!command) return -ENOMEM;
+
+    command[0] = 0;
+    for(int i = 0; argc && (i < argc); i++) {
+        if(i) strcpy(command + strlen(command), " ");
+        strcpy(command + strlen(command), argv[i]);
     }
 
+    if(argc) processRename(p, argv[0], command);
+    free(command);
+
     for(int i = 0; envc && (i < envc); i++) {
         envp[i] = malloc(strlen(envpSrc[i]) + 1);
         if(!envp[i]) return -ENOMEM;
@@ -249,8 +259,7 @@ int execrdv(Thread *t, const char *name, const char **argv) {
     }
 
     // set new name
-    strcpy(p->name, name);
-    strcpy(p->command, name);
+    processRename(p, name, name);
 
     // load from ramdisk
     int64_t size = ramdiskFileSize(name);
@@ -287,14 +296,12 @@ int execrdv(Thread *t, const char *name, const char **argv) {
 int execmve(Thread *t, void *image, const char **argv, const char **envp) {
     // create the new context before deleting the current one
     // this guarantees we can return on failure
-    uint64_t oldHighest = t->highest;
-
     void *newctx = calloc(1, PLATFORM_CONTEXT_SIZE);
     if(!newctx) {
         return -1;
     }
 
-    if(!platformCreateContext(newctx, PLATFORM_CONTEXT_USER, 0, 0)) {
+    if(!platformCreateContext(newctx, PLATFORM_CONTEXT_USER, 0, 0, 0)) {
         free(newctx);
         return -1;
     }
@@ -324,14 +331,19 @@ int execmve(Thread *t, void *image, const char **argv, const char **envp) {
     // this fixes a security risk i realized too late
     Process *p = getProcess(t->tid);
     p->umask = 0;
-    for(int i = 0; i < MAX_IO_DESCRIPTORS; i++) {
+    for(int i = 0; i < p->iodMax; i++) {
         if(p->io[i].valid && (p->io[i].flags & O_CLOEXEC)) {
-            p->io[i].valid = false;
-            p->io[i].data = NULL;
+            // release the objects that don't need a round trip to a server
+            // so that the other ends of pipes and sockets see them closed
+            switch(p->io[i].type) {
+            case IO_SOCKET: closeSocket(t, i); break;
+            case IO_EPOLL: closeEpoll(t, i); break;
+            case IO_PIPE: closePipe(t, i); break;
+            default: closeIO(p, &p->io[i]);
+            }
+
             p->io[i].type = 0;
             p->io[i].flags = 0;
-
-            p->iodCount--;
         }
     }
 
@@ -339,9 +351,12 @@ int execmve(Thread *t, void *image, const char **argv, const char **envp) {
     t->signals = signalDefaults();
     t->signalMask = 0;
 
-    // TODO: here we've successfully loaded the new program, but we also need
-    // to free up memory used by the original program
-    platformCleanThread(oldctx, oldHighest);
+    // the new program doesn't know about any shared rings the old one had
+    serverRingRelease(p->pid);
+
+    // here we've successfully loaded the new program, so the memory used by
+    // the original program is freed in the background
+    reclaimContext(oldctx);
     free(oldctx);
 
     t->status = THREAD_QUEUED;
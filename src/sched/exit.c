@@ -9,6 +9,7 @@
 #include <platform/context.h>
 #include <kernel/sched.h>
 #include <kernel/logger.h>
+#include <kernel/pipe.h>
 
 /* terminateThread(): helper function to terminate a thread
  * params: t - thread to exit
@@ -51,6 +52,10 @@ void terminateThread(Thread *t, int status, bool normal) {
         }
     }
 
+    // close the process's pipe ends so that the other ends see end of file
+    // or a broken pipe, which pipelines depend on
+    if(p->zombie) pipeRelease(p);
+
     if(p->zombie && p->childrenCount && p->children) {
         // parent process is now a zombie, mark all children as orphans before
         // the parent status is read and it quits
@@ -14,6 +14,8 @@
 #include <kernel/logger.h>
 #include <kernel/signal.h>
 #include <kernel/socket.h>
+#include <kernel/poll.h>
+#include <kernel/pipe.h>
 
 /* fork(): forks the running thread
  * params: t - pointer to thread structure
@@ -57,6 +59,7 @@ pid_t fork(Thread *t) {
     p->threads[0]->context = calloc(1, PLATFORM_CONTEXT_SIZE);
     p->threads[0]->signalContext = calloc(1, PLATFORM_CONTEXT_SIZE);
     p->threads[0]->highest = t->highest;
+    p->threads[0]->stackSize = t->stackSize;
     p->threads[0]->pages = t->pages;
     p->threads[0]->signalMask = t->signalMask;
 
@@ -88,17 +91,33 @@ pid_t fork(Thread *t) {
     // clone I/O descriptors
     Process *parent = getProcess(t->pid);
     if(parent) {
-        memcpy(p->io, parent->io, sizeof(IODescriptor) * MAX_IO_DESCRIPTORS);
+        // only the part of the descriptor table that is actually in use by
+        // the parent needs to be copied
+        if(parent->iodMax) {
+            p->io = malloc(parent->iodMax * sizeof(IODescriptor));
+            if(!p->io) {
+                platformCleanThread(p->threads[0]->context, p->threads[0]->highest);
+                free(p);
+                schedRelease();
+                return -ENOMEM;
+            }
+
+            memcpy(p->io, parent->io, parent->iodMax * sizeof(IODescriptor));
+            memcpy(p->iodBitmap, parent->iodBitmap, sizeof(p->iodBitmap));
+            p->iodFull = parent->iodFull;
+            p->iodMax = parent->iodMax;
+        }
+
         p->iodCount = parent->iodCount;
         p->umask = parent->umask;
+        p->colors = parent->colors;
 
         // increment reference counts for file and socket descriptors and close
         // those flagged with O_CLOFORK
-        for(int i = 0; i < MAX_IO_DESCRIPTORS; i++) {
+        for(int i = 0; i < p->iodMax; i++) {
             if(p->io[i].valid) {
                 if(p->io[i].flags & O_CLOFORK) {
-                    p->io[i].valid = 0;
-                    p->io[i].data = NULL;
+                    closeIO(p, &p->io[i]);
                     p->io[i].flags = 0;
                     continue;
                 }
@@ -112,6 +131,13 @@ pid_t fork(Thread *t) {
                     SocketDescriptor *socket = p->io[i].data;
                     socket->refCount++;
                     break;
+                case IO_EPOLL:
+                    Epoll *epoll = p->io[i].data;
+                    epoll->refCount++;
+                    break;
+                case IO_PIPE:
+                    pipeShare(&p->io[i]);
+                    break;
                 }
             }
         }
@@ -120,8 +146,7 @@ pid_t fork(Thread *t) {
         strcpy(p->cwd, parent->cwd);
 
         // clone command line and process name
-        strcpy(p->name, parent->name);
-        strcpy(p->command, parent->command);
+        processRename(p, parent->name, parent->command);
 
         // and process group
         p->pgrp = parent->pgrp;
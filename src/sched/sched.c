@@ -103,10 +103,11 @@ void releasePid(pid_t pid) {
 /* kthreadCreate(): spawns a new kernel thread
  * params: entry - entry point of the thread
  * params: arg - argument to be passed to the thread
+ * params: stack - stack size in bytes, zero for the platform default
  * returns: thread number, zero on failure
  */
 
-pid_t kthreadCreate(void *(*entry)(void *), void *arg) {
+pid_t kthreadCreate(void *(*entry)(void *), void *arg, size_t stack) {
     acquireLockBlocking(&lock);
     pid_t tid = allocatePid();
     if(!tid) {
@@ -150,7 +151,7 @@ pid_t kthreadCreate(void *(*entry)(void *), void *arg) {
     p->threadCount = 1;
     p->childrenCount = 0;
     p->children = NULL;
-    strcpy(p->command, "kernel");
+    processRename(p, "kernel", "kernel");
 
     p->threads = calloc(1, sizeof(Thread *));
     if(!p->threads) {
@@ -176,6 +177,7 @@ pid_t kthreadCreate(void *(*entry)(void *), void *arg) {
     p->threads[0]->tid = tid;
     //p->threads[0]->time = PLATFORM_TIMER_FREQUENCY;
     p->threads[0]->next = NULL;
+    p->threads[0]->stackSize = stack;
     p->threads[0]->context = calloc(1, PLATFORM_CONTEXT_SIZE);
     if(!p->threads[0]->context) {
         KERROR("failed to allocate memory for thread context\n");
@@ -187,7 +189,7 @@ pid_t kthreadCreate(void *(*entry)(void *), void *arg) {
         return 0;
     }
 
-    if(!platformCreateContext(p->threads[0]->context, PLATFORM_CONTEXT_KERNEL, (uintptr_t)entry, (uintptr_t)arg)) {
+    if(!platformCreateContext(p->threads[0]->context, PLATFORM_CONTEXT_KERNEL, (uintptr_t)entry, (uintptr_t)arg, stack)) {
         KERROR("failed to create kernel thread context\n");
         free(p->threads[0]->context);
         free(p->threads[0]);
@@ -433,6 +435,33 @@ pid_t processCreate() {
     return pid;
 }
 
+/* processRename(): replaces the name and command line of a process
+ * params: p - process
+ * params: name - file name, NULL for none
+ * params: command - command line with arguments, NULL for none
+ * returns: nothing, the old strings are kept if there is no memory for the
+ *          new ones since they are only informational
+ */
+
+void processRename(Process *p, const char *name, const char *command) {
+    char *newName = NULL, *newCommand = NULL;
+    if(name) newName = malloc(strlen(name) + 1);
+    if(command) newCommand = malloc(strlen(command) + 1);
+
+    if((name && !newName) || (command && !newCommand)) {
+        if(newName) free(newName);
+        if(newCommand) free(newCommand);
+        return;
+    }
+
+    if(newName) strcpy(newName, name);
+    if(newCommand) strcpy(newCommand, command);
+    if(p->name) free(p->name);
+    if(p->command) free(p->command);
+    p->name = newName;
+    p->command = newCommand;
+}
+
 /* threadUseContext(): switches to the paging context of a thread
  * params: tid - thread ID
  * returns: zero on success
@@ -7,6 +7,7 @@
 
 /* Kernel-Server Communication */
 
+#include <errno.h>
 #include <string.h>
 #include <platform/mmap.h>
 #include <platform/platform.h>
@@ -107,15 +108,20 @@ void getFramebuffer(Thread *t, int sd, const MessageHeader *req, void *res) {
     // so temporarily switch to it
     if(threadUseContext(t->tid)) return;
 
-    uintptr_t phys = ((uintptr_t)ttyStatus.fbhw - KERNEL_MMIO_BASE);
+    uintptr_t phys = ttyStatus.fbPhysical;
 
     size_t pages = (ttyStatus.h * ttyStatus.pitch + PAGE_SIZE - 1) / PAGE_SIZE;
     uintptr_t base = vmmAllocate(USER_MMIO_BASE, USER_LIMIT_ADDRESS, pages, VMM_USER | VMM_WRITE);
     if(!base) return;
 
-    // and finally map it
+    // and finally map it, write-combining unless the caller asked otherwise
+    int flags = PLATFORM_PAGE_PRESENT | PLATFORM_PAGE_USER | PLATFORM_PAGE_WRITE;
+    const FramebufferResponse *request = (const FramebufferResponse *) req;
+    if((req->length < sizeof(FramebufferResponse)) || !(request->flags & FRAMEBUFFER_CACHED))
+        flags |= PLATFORM_PAGE_WRITE_COMBINE;
+
     for(int i = 0; i < pages; i++) {
-        platformMapPage(base + (i * PAGE_SIZE), phys + (i * PAGE_SIZE), PLATFORM_PAGE_PRESENT | PLATFORM_PAGE_USER | PLATFORM_PAGE_WRITE);
+        platformMapPage(base + (i * PAGE_SIZE), phys + (i * PAGE_SIZE), flags);
     }
 
     response->buffer = base;
@@ -124,11 +130,62 @@ void getFramebuffer(Thread *t, int sd, const MessageHeader *req, void *res) {
     response->h = ttyStatus.h;
     response->bpp = ttyStatus.bpp;
     response->pitch = ttyStatus.pitch;
+    response->flags = (flags & PLATFORM_PAGE_WRITE_COMBINE) ? FRAMEBUFFER_WRITE_COMBINE : FRAMEBUFFER_CACHED;
 
     // and finally send the response
     send(NULL, sd, response, sizeof(FramebufferResponse), 0);
 }
 
+/* serverCacheColors(): restricts a process to a set of page colors so that
+ * an operator can partition the last-level cache between workloads */
+
+void serverCacheColors(Thread *t, int sd, const MessageHeader *req, void *res) {
+    CacheColorsCommand *request = (CacheColorsCommand *) req;
+    CacheColorsCommand *response = (CacheColorsCommand *) res;
+    memset(response, 0, sizeof(CacheColorsCommand));
+    memcpy(response, req, sizeof(MessageHeader));
+    response->header.response = 1;
+    response->header.length = sizeof(CacheColorsCommand);
+    response->count = pmmColors();
+
+    if(req->length < sizeof(CacheColorsCommand)) {
+        response->header.status = -EINVAL;
+        send(NULL, sd, response, sizeof(CacheColorsCommand), 0);
+        return;
+    }
+
+    response->pid = request->pid;
+    response->colors = request->colors;
+    Process *p = getProcess(request->pid);
+    if(p) {
+        p->colors = request->colors;
+        response->header.status = 0;
+    } else {
+        response->header.status = -ESRCH;
+    }
+
+    send(NULL, sd, response, sizeof(CacheColorsCommand), 0);
+}
+
+/* serverRing(): sets up shared request rings for the requesting server
+ * params: t - requesting server thread
+ * params: sd - socket descriptor to reply to
+ * params: req - request buffer
+ * params: res - response buffer
+ * returns: nothing - reply is sent to socket
+ */
+
+void serverRing(Thread *t, int sd, const MessageHeader *req, void *res) {
+    RingCommand *response = (RingCommand *) res;
+    memset(response, 0, sizeof(RingCommand));
+    memcpy(response, req, sizeof(MessageHeader));
+    response->header.response = 1;
+    response->header.length = sizeof(RingCommand);
+    response->header.status = serverRingCreate(t, sd, response);
+
+    send(NULL, sd, response, sizeof(RingCommand), 0);
+}
+
 /* dispatch table, much like syscalls */
 
 static void (*generalRequests[])(Thread *, int, const MessageHeader *req, void *res) = {
@@ -140,4 +197,6 @@ static void (*generalRequests[])(Thread *, int, const MessageHeader *req, void *
     NULL,               // 5 - get list of processes/threads
     NULL,               // 6 - get status of process/thread
     getFramebuffer,     // 7 - request framebuffer access
+    serverCacheColors,  // 8 - set process cache colors
+    serverRing,         // 9 - register shared request rings
 };
@@ -14,12 +14,19 @@
 #include <kernel/logger.h>
 #include <kernel/socket.h>
 #include <kernel/servers.h>
+#include <kernel/poll.h>
+
+#define SERVER_EPOLL_EVENTS     64
 
 int kernelSocket = 0, lumenSocket = 0;
 static int *connections;           // connected socket descriptors
 static struct sockaddr *connaddr;  // connected socket addresses
 static socklen_t *connlen;         // length of connected socket addresses
+static uint32_t *connhash;         // hashes of connected socket addresses
+static int serverEpoll;            // interest set of the kernel socket and connections
+static struct epoll_event events[SERVER_EPOLL_EVENTS];
 static void *in, *out;
+static size_t inSize = SERVER_MAX_SIZE;
 static int connectionCount = 0;
 static bool lumenConnected = false;
 
@@ -33,7 +40,7 @@ void serverInit() {
     addr.sun_family = AF_UNIX;
     strcpy(addr.sun_path, SERVER_KERNEL_PATH);     // this is a special path and not a true file
 
-    kernelSocket = socket(NULL, AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0);    // NEVER block the kernel
+    kernelSocket = socket(NULL, AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);   // NEVER block the kernel
     if(kernelSocket < 0) {
         KERROR("failed to open kernel socket: error code %d\n", -1*kernelSocket);
         while(1) platformHalt();
@@ -54,32 +61,55 @@ void serverInit() {
     connections = calloc(SERVER_MAX_CONNECTIONS, sizeof(int));
     connaddr = calloc(SERVER_MAX_CONNECTIONS, sizeof(struct sockaddr));
     connlen = calloc(SERVER_MAX_CONNECTIONS, sizeof(socklen_t));
+    connhash = calloc(SERVER_MAX_CONNECTIONS, sizeof(uint32_t));
     in = malloc(SERVER_MAX_SIZE);
     out = malloc(SERVER_MAX_SIZE);
 
-    if(!connections || !connaddr || !connlen || !in || !out) {
+    if(!connections || !connaddr || !connlen || !connhash || !in || !out) {
         KERROR("failed to allocate memory for incoming connections\n");
         while(1) platformHalt();
     }
 
+    serverEpoll = epoll_create(NULL, 0);
+    if(serverEpoll < 0) {
+        KERROR("failed to create kernel interest set: error code %d\n", -1*serverEpoll);
+        while(1) platformHalt();
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data = kernelSocket;
+    status = epoll_ctl(NULL, serverEpoll, EPOLL_CTL_ADD, kernelSocket, &ev);
+    if(status) {
+        KERROR("failed to watch kernel socket: error code %d\n", -1*status);
+        while(1) platformHalt();
+    }
+
     KDEBUG("kernel is listening on socket %d: %s\n", kernelSocket, addr.sun_path);
 }
 
-/* serverIdle(): handles incoming kernel connections when idle
+/* serverAccept(): accepts incoming kernel connections
  * params: none
  * returns: nothing
  */
 
-void serverIdle() {
-    // check for incoming connections
-    setLocalSched(false);
+static void serverAccept() {
+    while(connectionCount < SERVER_MAX_CONNECTIONS) {
+        connlen[connectionCount] = sizeof(struct sockaddr);
+        int sd = accept(NULL, kernelSocket, &connaddr[connectionCount], &connlen[connectionCount]);
+        if(sd <= 0 || sd >= MAX_IO_DESCRIPTORS) return;
 
-    connlen[connectionCount] = sizeof(struct sockaddr);
-    int sd = accept(NULL, kernelSocket, &connaddr[connectionCount], &connlen[connectionCount]);
-    if(sd > 0 && sd < MAX_IO_DESCRIPTORS) {
         //KDEBUG("kernel accepted connection from %s\n", connaddr[connectionCount].sa_data);
         connections[connectionCount] = sd;
+        connhash[connectionCount] = socketHash(connaddr[connectionCount].sa_data);
         connectionCount++;
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data = sd;
+        int status = epoll_ctl(NULL, serverEpoll, EPOLL_CTL_ADD, sd, &ev);
+        if(status) KWARN("failed to watch socket %d: error code %d\n", sd, -1*status);
+
         if(!lumenConnected) {
             // connect to lumen
             KDEBUG("connected to lumen at socket %d\n", sd);
@@ -87,39 +117,102 @@ void serverIdle() {
             lumenSocket = sd;
         }
     }
+}
+
+/* serverDisconnect(): drops a connection to a server
+ * params: sd - socket descriptor
+ * returns: nothing
+ */
+
+static void serverDisconnect(int sd) {
+    epoll_ctl(NULL, serverEpoll, EPOLL_CTL_DEL, sd, NULL);
+    serverRingClose(sd);
 
-    // check if any of the incoming connections sent anything
-    if(!connectionCount) {
-        setLocalSched(true);
-        return;
+    for(int i = 0; i < connectionCount; i++) {
+        if(connections[i] != sd) continue;
+
+        // keep the list of connections packed
+        connectionCount--;
+        connections[i] = connections[connectionCount];
+        connaddr[i] = connaddr[connectionCount];
+        connlen[i] = connlen[connectionCount];
+        connhash[i] = connhash[connectionCount];
+        break;
     }
 
+    closeSocket(NULL, sd);
+}
+
+/* serverReceive(): handles all complete messages queued on a connection
+ * params: sd - socket descriptor
+ * returns: true if the connection was dropped
+ */
+
+static bool serverReceive(int sd) {
     MessageHeader *h = (MessageHeader *) in;
-    for(int i = 0; i < connectionCount; i++) {
-        sd = connections[i];
-        ssize_t s = recv(NULL, sd, in, SERVER_MAX_SIZE, MSG_PEEK);  // peek to check size
-        while(s > 0 && s <= SERVER_MAX_SIZE) {
-            if(h->length > SERVER_MAX_SIZE) {
-                void *newptr = realloc(in, h->length);
-                if(!newptr) KPANIC("ran out of physical memory while handling incoming requests\n");
-
-                in = newptr;
-                h = (MessageHeader *) in;
-            }
-
-            recv(NULL, sd, in, h->length, 0);       // read the actual message
-
-            if(h->command <= MAX_GENERAL_COMMAND) handleGeneralRequest(sd, in, out);
-            else if(h->command >= 0x8000 && h->command <= MAX_SYSCALL_COMMAND) handleSyscallResponse(sd, (SyscallHeader *)h);
-            else {
-                // TODO
-                KWARN("unimplemented message command 0x%02X, dropping...\n", h->command);
-            }
-
-            s = recv(NULL, sd, in, SERVER_MAX_SIZE, MSG_PEEK);
+
+    // the kernel socket is a stream socket and senders write messages
+    // whole, so read the header and then exactly the rest of the message
+    ssize_t s = recv(NULL, sd, in, sizeof(MessageHeader), MSG_WAITALL);
+    while(s == sizeof(MessageHeader)) {
+        if(h->length < sizeof(MessageHeader)) {
+            // there is no way to find where the next message starts
+            KWARN("dropping connection on socket %d after malformed message of length %d\n", sd, h->length);
+            serverDisconnect(sd);
+            return true;
+        }
+
+        if(h->length > inSize) {
+            void *newptr = realloc(in, h->length);
+            if(!newptr) KPANIC("ran out of physical memory while handling incoming requests\n");
+
+            in = newptr;
+            inSize = h->length;
+            h = (MessageHeader *) in;
+        }
+
+        if(h->length > sizeof(MessageHeader))
+            recv(NULL, sd, (void *)((uintptr_t) in + sizeof(MessageHeader)), h->length - sizeof(MessageHeader), 0);
+
+        if(h->command <= MAX_GENERAL_COMMAND) handleGeneralRequest(sd, in, out);
+        else if(h->command >= 0x8000 && h->command <= MAX_SYSCALL_COMMAND) handleSyscallResponse(sd, (SyscallHeader *)h);
+        else {
+            // TODO
+            KWARN("unimplemented message command 0x%02X, dropping...\n", h->command);
         }
+
+        s = recv(NULL, sd, in, sizeof(MessageHeader), MSG_WAITALL);
     }
 
+    return false;
+}
+
+/* serverIdle(): handles incoming kernel connections when idle
+ * params: none
+ * returns: nothing
+ */
+
+void serverIdle() {
+    setLocalSched(false);
+
+    // only visit the connections that have something to read instead of
+    // polling every connection on every idle pass
+    int count = epoll_wait(NULL, serverEpoll, events, SERVER_EPOLL_EVENTS);
+    for(int i = 0; i < count; i++) {
+        int sd = events[i].data;
+        if(sd == kernelSocket) {
+            serverAccept();
+            continue;
+        }
+
+        // handle whatever the server sent before it went away
+        if((events[i].events & EPOLLIN) && serverReceive(sd)) continue;
+        if(events[i].events & EPOLLHUP) serverDisconnect(sd);
+    }
+
+    // responses on shared rings don't make the connection readable
+    serverRingIdle();
+
     setLocalSched(true);
 }
 
@@ -131,8 +224,10 @@ void serverIdle() {
 int serverSocket(const char *path) {
     if(!connectionCount) return -1;
 
+    // compare hashes first to avoid most of the string comparisons
+    uint32_t hash = socketHash(path);
     for(int i = 0; i < connectionCount; i++) {
-        if(!strcmp(connaddr[i].sa_data, path)) return connections[i];
+        if((connhash[i] == hash) && !strcmp(connaddr[i].sa_data, path)) return connections[i];
     }
 
     return -1;
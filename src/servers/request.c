@@ -26,6 +26,10 @@ int requestServer(Thread *t, int sd, void *msg) {
 
     if(!sd) sd = lumenSocket;
 
+    // servers with shared rings take requests without a socket operation,
+    // and the socket is only used when the ring is full or too small
+    if(!serverRingSubmit(sd, hdr)) return 0;
+
     ssize_t s = send(NULL, sd, hdr, hdr->header.length, 0);
     if(s == hdr->header.length) return 0;
     else if(s >= 0) return -ENOBUFS;
@@ -0,0 +1,377 @@
+/*
+ * lux - a lightweight unix-like operating system
+ * Omar Elghoul, 2024
+ *
+ * Core Microkernel
+ */
+
+/* Kernel-Server Communication */
+/* shared request rings are implemented here */
+
+/* the shared area of a server is one physically contiguous block, so that the
+ * kernel reaches it through the direct mapping from any address space while
+ * the server sees it at an address in its own; the block starts with the ring
+ * header and is followed by the message buffers
+ *
+ * the block belongs to the kernel and is mapped into the server as shared
+ * pages, which neither munmap() nor address space reclaim free; the kernel
+ * stops using it as soon as the connection closes, but only frees it once the
+ * server has exited or replaced itself with exec(), because until then the
+ * server can still reach it */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <platform/platform.h>
+#include <platform/mmap.h>
+#include <platform/lock.h>
+#include <kernel/servers.h>
+#include <kernel/socket.h>
+#include <kernel/logger.h>
+#include <kernel/memory.h>
+#include <kernel/sched.h>
+
+#define RING_HEADER_PAGES       ((sizeof(RingHeader) + PAGE_SIZE - 1) / PAGE_SIZE)
+#define RING_PAGES              (RING_HEADER_PAGES + (SERVER_RING_BUFFERS * SERVER_RING_BUFFER_SIZE / PAGE_SIZE))
+
+typedef struct ServerRing {
+    lock_t lock;
+    int sd;                     // -1 once the connection is closed
+    pid_t pid;                  // server process
+    uintptr_t phys;             // shared area, zero once it is freed
+    RingHeader *header;         // kernel view of the shared area, NULL when unused
+    uintptr_t buffers;          // kernel address of the first buffer
+    uint64_t free;              // bitmap of buffers owned by the kernel
+    uint32_t submissionTail;    // private copies, because the server can write
+    uint32_t completionHead;    // over the ones in the shared area
+    struct ServerRing *next;    // in the list of spare structures
+} ServerRing;
+
+/* ring structures are kept on a spare list for reuse rather than freed, so
+ * that a submitter or a drain never sees one disappear under it; the global
+ * lock is always taken before the lock of a ring, and neither is held while
+ * calling into the scheduler */
+static lock_t lock = LOCK_INITIAL;
+static lock_t drainLock = LOCK_INITIAL;
+static ServerRing *rings[MAX_IO_DESCRIPTORS];       // indexed by connection
+static ServerRing *active[SERVER_MAX_CONNECTIONS];  // all rings owning an area
+static int activeCount = 0;
+static ServerRing *spare = NULL;
+static void *drain;                 // private copy of a response being handled
+
+/* serverRingCreate(): creates and maps the shared rings of a server
+ * params: t - server thread
+ * params: sd - socket descriptor of the server's connection
+ * params: response - response to fill in with the layout of the shared area
+ * returns: zero on success, negative error code on fail
+ */
+
+int serverRingCreate(Thread *t, int sd, RingCommand *response) {
+    if(sd <= 0 || sd >= MAX_IO_DESCRIPTORS) return -EBADF;
+
+    acquireLockBlocking(&lock);
+    if(rings[sd]) {
+        releaseLock(&lock);
+        return -EEXIST;
+    }
+
+    if(activeCount >= SERVER_MAX_CONNECTIONS) {
+        releaseLock(&lock);
+        return -ENFILE;
+    }
+
+    if(!drain) {
+        drain = malloc(SERVER_RING_BUFFER_SIZE);
+        if(!drain) {
+            releaseLock(&lock);
+            return -ENOMEM;
+        }
+    }
+
+    ServerRing *ring = spare;
+    if(ring) spare = ring->next;
+    else ring = calloc(1, sizeof(ServerRing));
+    if(!ring) {
+        releaseLock(&lock);
+        return -ENOMEM;
+    }
+
+    uintptr_t phys = pmmAllocateContiguous(RING_PAGES, 0);
+    if(!phys) {
+        ring->next = spare;
+        spare = ring;
+        releaseLock(&lock);
+        return -ENOMEM;
+    }
+
+    // map the area into the server the same way as the frame buffer, but as
+    // shared pages so that the server can't free them under the kernel
+    uintptr_t base = 0;
+    if(!threadUseContext(t->tid))
+        base = vmmAllocate(USER_MMIO_BASE, USER_LIMIT_ADDRESS, RING_PAGES, VMM_USER | VMM_WRITE);
+    if(!base) {
+        pmmFreeContiguous(phys, RING_PAGES);
+        ring->next = spare;
+        spare = ring;
+        releaseLock(&lock);
+        return -ENOMEM;
+    }
+
+    for(int i = 0; i < RING_PAGES; i++)
+        platformMapPage(base + (i * PAGE_SIZE), phys + (i * PAGE_SIZE),
+            PLATFORM_PAGE_PRESENT | PLATFORM_PAGE_USER | PLATFORM_PAGE_WRITE | PLATFORM_PAGE_SHARED);
+
+    acquireLockBlocking(&ring->lock);
+    ring->phys = phys;
+    ring->header = (RingHeader *) vmmMMIO(phys, true);
+    memset(ring->header, 0, sizeof(RingHeader));
+    ring->buffers = (uintptr_t) ring->header + (RING_HEADER_PAGES * PAGE_SIZE);
+    ring->free = ((uint64_t) 1 << SERVER_RING_BUFFERS) - 1;
+    ring->submissionTail = 0;
+    ring->completionHead = 0;
+    ring->sd = sd;
+    ring->pid = t->pid;
+    ring->next = NULL;
+    releaseLock(&ring->lock);
+
+    rings[sd] = ring;
+    active[activeCount] = ring;
+    activeCount++;
+    releaseLock(&lock);
+
+    response->base = base;
+    response->size = RING_PAGES * PAGE_SIZE;
+    response->buffers = RING_HEADER_PAGES * PAGE_SIZE;
+    response->bufferSize = SERVER_RING_BUFFER_SIZE;
+    response->bufferCount = SERVER_RING_BUFFERS;
+    response->entries = SERVER_RING_ENTRIES;
+    return 0;
+}
+
+/* serverRingSubmit(): submits a request on the shared rings of a server
+ * params: sd - socket descriptor of the server's connection
+ * params: msg - request message
+ * returns: zero on success, negative error code if the request must be sent
+ * over the socket instead
+ */
+
+int serverRingSubmit(int sd, void *msg) {
+    if(sd <= 0 || sd >= MAX_IO_DESCRIPTORS) return -EBADF;
+
+    ServerRing *ring = rings[sd];
+    if(!ring) return -ENOENT;
+
+    MessageHeader *hdr = (MessageHeader *) msg;
+    if(hdr->length > SERVER_RING_BUFFER_SIZE) return -EMSGSIZE;
+
+    // the structure may have been closed or reused since it was looked up
+    acquireLockBlocking(&ring->lock);
+    if(!ring->header || (ring->sd != sd)) {
+        releaseLock(&ring->lock);
+        return -ENOENT;
+    }
+
+    // the server's head is only trusted as far as it is consistent
+    RingQueue *queue = &ring->header->submission;
+    uint32_t head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+    if(!ring->free || ((ring->submissionTail - head) >= SERVER_RING_ENTRIES)) {
+        releaseLock(&ring->lock);
+        return -ENOBUFS;
+    }
+
+    int buffer = __builtin_ctzll(ring->free);
+    ring->free &= ~((uint64_t) 1 << buffer);
+    memcpy((void *)(ring->buffers + (buffer * SERVER_RING_BUFFER_SIZE)), msg, hdr->length);
+
+    RingDescriptor *entry = &queue->entries[ring->submissionTail & (SERVER_RING_ENTRIES - 1)];
+    entry->command = hdr->command;
+    entry->buffer = buffer;
+    entry->length = hdr->length;
+    entry->requester = hdr->requester;
+
+    // publish the entry before looking at whether the server is asleep, and
+    // only then pay for a socket message to wake it up
+    ring->submissionTail++;
+    __atomic_store_n(&queue->tail, ring->submissionTail, __ATOMIC_SEQ_CST);
+    bool wakeup = __atomic_load_n(&ring->header->flags, __ATOMIC_SEQ_CST) & SERVER_RING_WAKEUP;
+    if(wakeup) __atomic_fetch_and(&ring->header->flags, ~SERVER_RING_WAKEUP, __ATOMIC_SEQ_CST);
+    releaseLock(&ring->lock);
+
+    if(wakeup) {
+        MessageHeader doorbell;
+        memset(&doorbell, 0, sizeof(MessageHeader));
+        doorbell.command = COMMAND_RING;
+        doorbell.length = sizeof(MessageHeader);
+        send(NULL, sd, &doorbell, sizeof(MessageHeader), 0);
+    }
+
+    return 0;
+}
+
+/* serverRingPop(): takes one response off the completion ring of a server and
+ * returns its buffer to the kernel
+ * params: ring - shared rings of the server
+ * params: sd - pointer to store the connection the response came from
+ * returns: length of the response copied into the drain buffer, zero if the
+ * completion only returned a buffer, negative if the ring is empty
+ */
+
+static ssize_t serverRingPop(ServerRing *ring, int *sd) {
+    acquireLockBlocking(&ring->lock);
+    if(!ring->header) {
+        releaseLock(&ring->lock);
+        return -1;
+    }
+
+    RingQueue *queue = &ring->header->completion;
+    uint32_t tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+    if((tail - ring->completionHead) > SERVER_RING_ENTRIES) {
+        KWARN("dropping inconsistent completion ring of socket %d\n", ring->sd);
+        ring->completionHead = tail;
+        __atomic_store_n(&queue->head, tail, __ATOMIC_RELEASE);
+    }
+
+    if(ring->completionHead == tail) {
+        releaseLock(&ring->lock);
+        return -1;
+    }
+
+    RingDescriptor entry = queue->entries[ring->completionHead & (SERVER_RING_ENTRIES - 1)];
+    ring->completionHead++;
+    __atomic_store_n(&queue->head, ring->completionHead, __ATOMIC_RELEASE);
+
+    uint64_t bit = (entry.buffer < SERVER_RING_BUFFERS) ? ((uint64_t) 1 << entry.buffer) : 0;
+    if(!bit || (ring->free & bit)) {
+        KWARN("dropping completion of unowned buffer %d on socket %d\n", entry.buffer, ring->sd);
+        releaseLock(&ring->lock);
+        return 0;
+    }
+
+    // copy the response out of server-writable memory before it is parsed
+    size_t length = entry.length;
+    if(length > SERVER_RING_BUFFER_SIZE) length = SERVER_RING_BUFFER_SIZE;
+    if(length) memcpy(drain, (const void *)(ring->buffers + (entry.buffer * SERVER_RING_BUFFER_SIZE)), length);
+
+    ring->free |= bit;
+    *sd = ring->sd;
+    releaseLock(&ring->lock);
+    return length;
+}
+
+/* serverRingRemove(): frees the shared area of the rings at an index of the
+ * active list after their server is gone
+ * params: index - index of the rings, the global lock must be held
+ * returns: nothing
+ */
+
+static void serverRingRemove(int index) {
+    ServerRing *ring = active[index];
+    if((ring->sd > 0) && (rings[ring->sd] == ring)) rings[ring->sd] = NULL;
+
+    acquireLockBlocking(&ring->lock);
+    ring->header = NULL;
+    ring->sd = -1;
+    releaseLock(&ring->lock);
+
+    pmmFreeContiguous(ring->phys, RING_PAGES);
+    ring->phys = 0;
+    ring->next = spare;
+    spare = ring;
+
+    activeCount--;
+    active[index] = active[activeCount];
+    active[activeCount] = NULL;
+}
+
+/* serverRingIdle(): frees the rings of servers that exited and handles the
+ * responses on all other shared rings
+ * params: none
+ * returns: nothing
+ */
+
+void serverRingIdle() {
+    if(!activeCount || !acquireLock(&drainLock)) return;
+
+    // servers can exit with the scheduler locked, so their rings are freed here
+    acquireLockBlocking(&lock);
+    int i = 0;
+    while(i < activeCount) {
+        Process *p = getProcess(active[i]->pid);
+        if(!p || p->zombie) serverRingRemove(i);
+        else i++;
+    }
+
+    releaseLock(&lock);
+
+    for(i = 0; ; i++) {
+        acquireLockBlocking(&lock);
+        if(i >= activeCount) {
+            releaseLock(&lock);
+            break;
+        }
+
+        ServerRing *ring = active[i];
+        releaseLock(&lock);
+
+        // no ring lock is held while handling the response, because that may
+        // have to take the scheduler lock
+        int sd;
+        ssize_t length;
+        while((length = serverRingPop(ring, &sd)) >= 0) {
+            if(!length) continue;
+
+            const MessageHeader *h = (const MessageHeader *) drain;
+            if((length < sizeof(SyscallHeader)) || (h->length > length) || !h->response)
+                KWARN("dropping malformed completion of length %d on socket %d\n", length, sd);
+            else if(h->command >= 0x8000 && h->command <= MAX_SYSCALL_COMMAND)
+                handleSyscallResponse(sd, (const SyscallHeader *) h);
+            else
+                KWARN("unimplemented message command 0x%02X, dropping...\n", h->command);
+        }
+    }
+
+    releaseLock(&drainLock);
+}
+
+/* serverRingClose(): stops using the shared rings of a connection that closed
+ * params: sd - socket descriptor of the connection
+ * returns: nothing
+ *
+ * the server may still have the area mapped, so it is only freed once the
+ * server is gone
+ */
+
+void serverRingClose(int sd) {
+    if(sd <= 0 || sd >= MAX_IO_DESCRIPTORS) return;
+
+    acquireLockBlocking(&lock);
+    ServerRing *ring = rings[sd];
+    if(ring) {
+        rings[sd] = NULL;
+        acquireLockBlocking(&ring->lock);
+        ring->header = NULL;
+        ring->sd = -1;
+        releaseLock(&ring->lock);
+    }
+
+    releaseLock(&lock);
+}
+
+/* serverRingRelease(): frees the shared rings of a server whose address space
+ * is being replaced
+ * params: pid - process ID of the server
+ * returns: nothing
+ */
+
+void serverRingRelease(pid_t pid) {
+    if(!activeCount) return;
+
+    acquireLockBlocking(&lock);
+    int i = 0;
+    while(i < activeCount) {
+        if(active[i]->pid == pid) serverRingRemove(i);
+        else i++;
+    }
+
+    releaseLock(&lock);
+}
@@ -40,15 +40,15 @@ void handleSyscallResponse(int sd, const SyscallHeader *hdr) {
     case COMMAND_STAT:
         if(hdr->header.status) break;
         StatCommand *statcmd = (StatCommand *) hdr;
-        threadUseContext(req->thread->tid);
-        memcpy((void *)req->params[1], &statcmd->buffer, sizeof(struct stat));
+        if(copyToUser(req->thread, (void *)req->params[1], &statcmd->buffer, sizeof(struct stat)))
+            req->ret = -EFAULT;
         break;
     
     case COMMAND_STATVFS:
         if(hdr->header.status) break;
         StatvfsCommand *statvfscmd = (StatvfsCommand *) hdr;
-        threadUseContext(req->thread->tid);
-        memcpy((void *)req->params[1], &statvfscmd->buffer, sizeof(struct statvfs));
+        if(copyToUser(req->thread, (void *)req->params[1], &statvfscmd->buffer, sizeof(struct statvfs)))
+            req->ret = -EFAULT;
         break;
 
     case COMMAND_OPEN:
@@ -76,6 +76,9 @@ void handleSyscallResponse(int sd, const SyscallHeader *hdr) {
         file->sd = sd;
         file->charDev = opencmd->charDev;
 
+        // servers built before handles existed send a shorter response
+        if(hdr->header.length >= sizeof(OpenCommand)) file->handle = opencmd->handle;
+
         strcpy(file->abspath, opencmd->abspath);
         strcpy(file->device, opencmd->device);
         strcpy(file->path, opencmd->path);
@@ -85,6 +88,7 @@ void handleSyscallResponse(int sd, const SyscallHeader *hdr) {
         break;
 
     case COMMAND_READ:
+    case COMMAND_HANDLE_READ:
         status = (ssize_t) hdr->header.status;
 
         if((status == -EWOULDBLOCK || status == -EAGAIN) && !(p->io[req->params[0]].flags & O_NONBLOCK)) {
@@ -99,17 +103,32 @@ void handleSyscallResponse(int sd, const SyscallHeader *hdr) {
             return;
         } else if(status < 0) break;  // here an actual error happened
         
-        RWCommand *readcmd = (RWCommand *) hdr;
-        threadUseContext(req->thread->tid);
-        memcpy((void *)req->params[1], readcmd->data, hdr->header.status);
+        // the compact form only differs in where the data and position are
+        const void *data;
+        off_t position;
+        if(hdr->header.command == COMMAND_HANDLE_READ) {
+            HandleRWCommand *handlecmd = (HandleRWCommand *) hdr;
+            data = handlecmd->data;
+            position = handlecmd->position;
+        } else {
+            RWCommand *readcmd = (RWCommand *) hdr;
+            data = readcmd->data;
+            position = readcmd->position;
+        }
+
+        if(copyToUser(req->thread, (void *)req->params[1], data, hdr->header.status)) {
+            req->ret = -EFAULT;
+            break;
+        }
 
         // update file position
         file = (FileDescriptor *) p->io[req->params[0]].data;
-        file->position = readcmd->position;
+        file->position = position;
 
         break;
 
     case COMMAND_WRITE:
+    case COMMAND_HANDLE_WRITE:
         status = (ssize_t) hdr->header.status;
 
         if((status == -EWOULDBLOCK || status == -EAGAIN) && !(p->io[req->params[0]].flags & O_NONBLOCK)) {
@@ -124,11 +143,12 @@ void handleSyscallResponse(int sd, const SyscallHeader *hdr) {
             return;
         } else if(status < 0) break;  // here an actual error happened
 
-        RWCommand *writecmd = (RWCommand *) hdr;
-
         // update file position
         file = (FileDescriptor *) p->io[req->params[0]].data;
-        file->position = writecmd->position;
+        if(hdr->header.command == COMMAND_HANDLE_WRITE)
+            file->position = ((HandleRWCommand *) hdr)->position;
+        else
+            file->position = ((RWCommand *) hdr)->position;
         break;
 
     case COMMAND_IOCTL:
@@ -138,9 +158,9 @@ void handleSyscallResponse(int sd, const SyscallHeader *hdr) {
         status = (ssize_t) hdr->header.status;
 
         if((status >= 0) && (ioctlcmd->opcode & IOCTL_OUT_PARAM)) {
-            threadUseContext(req->thread->tid);
-            unsigned long *out = (unsigned long *) req->params[2];
-            *out = ioctlcmd->parameter;
+            unsigned long out = ioctlcmd->parameter;
+            if(copyToUser(req->thread, (void *)req->params[2], &out, sizeof(unsigned long)))
+                req->ret = -EFAULT;
         }
 
         break;
@@ -182,15 +202,19 @@ void handleSyscallResponse(int sd, const SyscallHeader *hdr) {
         dir->position = readdircmd->position;
 
         // and copy the descriptor and write its pointer into the buffer
-        threadUseContext(req->thread->tid);
-        struct dirent **direntptr = (struct dirent **) req->params[2];
+        struct dirent *direntptr = NULL;
         if(!readdircmd->end) {
-            memcpy((void *)req->params[1], &readdircmd->entry, sizeof(struct dirent) + strlen(readdircmd->entry.d_name) + 1);
-            *direntptr = (struct dirent *) req->params[1];
-        } else {
-            *direntptr = NULL;
+            if(copyToUser(req->thread, (void *)req->params[1], &readdircmd->entry, sizeof(struct dirent) + strlen(readdircmd->entry.d_name) + 1)) {
+                req->ret = -EFAULT;
+                break;
+            }
+
+            direntptr = (struct dirent *) req->params[1];
         }
 
+        if(copyToUser(req->thread, (void *)req->params[2], &direntptr, sizeof(struct dirent *)))
+            req->ret = -EFAULT;
+
         break;
     
     case COMMAND_EXEC:
@@ -229,21 +253,25 @@ void handleSyscallResponse(int sd, const SyscallHeader *hdr) {
         if(hdr->header.status <= 0) break;
 
         ReadLinkCommand *rlcmd = (ReadLinkCommand *) hdr;
-        threadUseContext(req->thread->tid);
 
         size_t linkLength = hdr->header.status;
         if(linkLength > req->params[2]) linkLength = req->params[2];
 
         req->ret = linkLength;
-        memcpy((void *) req->params[1], rlcmd->path, linkLength);       
+        if(copyToUser(req->thread, (void *) req->params[1], rlcmd->path, linkLength))
+            req->ret = -EFAULT;
         break;
 
     case COMMAND_FSYNC:
+    case COMMAND_HANDLE_FSYNC:
         if(hdr->header.status) break;
 
         /* special handling for close() after syncing I/O */
-        FsyncCommand *fscmd = (FsyncCommand *) hdr;
-        if(!fscmd->close) break;
+        if(hdr->header.command == COMMAND_HANDLE_FSYNC) {
+            if(!((HandleFsyncCommand *) hdr)->close) break;
+        } else {
+            if(!((FsyncCommand *) hdr)->close) break;
+        }
 
         file = (FileDescriptor *) p->io[req->params[0]].data;
         if(!file) break;
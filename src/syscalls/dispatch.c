@@ -8,6 +8,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <errno.h>
+#include <string.h>
 #include <platform/mmap.h>
 #include <platform/platform.h>
 #include <kernel/sched.h>
@@ -19,6 +20,8 @@
 #include <kernel/irq.h>
 #include <kernel/dirent.h>
 #include <kernel/signal.h>
+#include <kernel/poll.h>
+#include <kernel/pipe.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/time.h>
@@ -37,7 +40,7 @@
 
 bool syscallVerifyPointer(SyscallRequest *req, uintptr_t base, uintptr_t len) {
     uintptr_t end = base + len;
-    if(base < USER_BASE_ADDRESS || end > USER_LIMIT_ADDRESS) {
+    if(base < USER_BASE_ADDRESS || end < base || end > USER_LIMIT_ADDRESS) {
         KWARN("killing tid %d for memory access violation at 0x%X (%d)\n", req->thread->tid, base, len);
         terminateThread(req->thread, -1, false);
         return false;
@@ -211,6 +214,19 @@ void syscallDispatchClose(SyscallRequest *req) {
     }
 }
 
+/* syscallFileDescriptor(): checks whether an I/O descriptor is a file, whose
+ * requests are relayed to a server and completed asynchronously
+ * params: req - syscall request
+ * params: fd - descriptor
+ * returns: true if the descriptor is a file
+ */
+
+static bool syscallFileDescriptor(SyscallRequest *req, int fd) {
+    Process *p = getProcess(req->thread->pid);
+    if(!p || fd < 0 || fd >= p->iodMax || !p->io[fd].valid) return false;
+    return p->io[fd].type == IO_FILE;
+}
+
 void syscallDispatchRead(SyscallRequest *req) {
     if(syscallVerifyPointer(req, req->params[1], req->params[2])) {
         uint16_t id;
@@ -235,7 +251,8 @@ void syscallDispatchRead(SyscallRequest *req) {
                 syscallEnqueue(req);
                 return;
             }
-        } else if(status) {
+        } else if(status || !syscallFileDescriptor(req, req->params[0])) {
+            // only files complete later, zero from a pipe or socket is final
             req->external = false;
             req->ret = status;      // status or error code
             req->unblock = true;
@@ -262,16 +279,20 @@ void syscallDispatchWrite(SyscallRequest *req) {
             // return without unblocking if necessary for sockets
             Process *p = getProcess(req->thread->pid);
             if(!(p->io[req->params[0]].flags & O_NONBLOCK)) {
-                // block by putting the syscall back in the queue
+                // sockets sleep until the peer makes room, anything else is
+                // put back in the queue
                 req->unblock = false;
                 req->busy = false;
-                req->queued = true;
                 req->next = NULL;
                 req->retry = true;
+                if(socketSendWait(req, req->params[2])) return;
+
+                req->queued = true;
                 syscallEnqueue(req);
                 return;
             }
-        } else if(status) {
+        } else if(status || !syscallFileDescriptor(req, req->params[0])) {
+            // only files complete later, zero from a pipe or socket is final
             req->external = false;
             req->ret = status;      // status or error code
             req->unblock = true;
@@ -665,11 +686,14 @@ void syscallDispatchAccept(SyscallRequest *req) {
         // return without unblocking if necessary
         Process *p = getProcess(req->thread->pid);
         if(!(p->io[req->params[0]].flags & O_NONBLOCK)) {
-            // block by putting the syscall back in the queue
+            // sleep until connect() wakes the syscall, or put it back in the
+            // queue if a connection arrived in the meantime
             req->unblock = false;
             req->busy = false;
-            req->queued = true;
             req->next = NULL;
+            if(socketAcceptWait(req)) return;
+
+            req->queued = true;
             syscallEnqueue(req);
             return;
         }
@@ -712,11 +736,78 @@ void syscallDispatchSend(SyscallRequest *req) {
             // return without unblocking if necessary
             Process *p = getProcess(req->thread->pid);
             if(!(p->io[req->params[0]].flags & O_NONBLOCK)) {
-                // block by putting the syscall back in the queue
+                // sleep until recv() makes room, or put the syscall back in
+                // the queue if there is room already
                 req->unblock = false;
                 req->busy = false;
+                req->next = NULL;
+                if(socketSendWait(req, req->params[2])) return;
+
                 req->queued = true;
+                syscallEnqueue(req);
+                return;
+            }
+        }
+
+        req->ret = status;
+        req->unblock = true;
+    }
+}
+
+/* syscallCopyBatch(): copies in and verifies the batch of a sendmmsg() or
+ * recvmmsg(), so that other threads of the caller can't change the buffers
+ * after they were verified
+ * params: req - syscall request
+ * params: msgvec - kernel array of SOCKET_MMSG_MAX entries to copy into
+ * returns: number of messages, -1 if unsafe, user program terminated as well
+ */
+
+static int syscallCopyBatch(SyscallRequest *req, struct mmsghdr *msgvec) {
+    unsigned int vlen = req->params[2];
+    if(vlen > SOCKET_MMSG_MAX) vlen = SOCKET_MMSG_MAX;
+    if(!syscallVerifyPointer(req, req->params[1], vlen * sizeof(struct mmsghdr)))
+        return -1;
+
+    memcpy(msgvec, (const void *) req->params[1], vlen * sizeof(struct mmsghdr));
+    for(unsigned int i = 0; i < vlen; i++) {
+        if(!syscallVerifyPointer(req, (uintptr_t) msgvec[i].msg_buf, msgvec[i].msg_size))
+            return -1;
+    }
+
+    return vlen;
+}
+
+/* syscallReturnBatch(): stores the status of each message of a batch
+ * params: req - syscall request
+ * params: msgvec - kernel copy of the batch
+ * params: vlen - number of messages
+ * returns: nothing
+ */
+
+static void syscallReturnBatch(SyscallRequest *req, const struct mmsghdr *msgvec, int vlen) {
+    struct mmsghdr *user = (struct mmsghdr *) req->params[1];
+    for(int i = 0; i < vlen; i++)
+        user[i].msg_len = msgvec[i].msg_len;
+}
+
+void syscallDispatchSendMmsg(SyscallRequest *req) {
+    struct mmsghdr msgvec[SOCKET_MMSG_MAX];
+    int vlen = syscallCopyBatch(req, msgvec);
+    if(vlen >= 0) {
+        int status = sendmmsg(req->thread, req->params[0], msgvec, vlen, req->params[3]);
+        syscallReturnBatch(req, msgvec, vlen);
+
+        // block the thread if necessary, nothing was sent so it is the first
+        // message that didn't fit
+        if(status == -EWOULDBLOCK || status == -EAGAIN) {
+            Process *p = getProcess(req->thread->pid);
+            if(!(p->io[req->params[0]].flags & O_NONBLOCK)) {
+                req->unblock = false;
+                req->busy = false;
                 req->next = NULL;
+                if(vlen && socketSendWait(req, msgvec[0].msg_size)) return;
+
+                req->queued = true;
                 syscallEnqueue(req);
                 return;
             }
@@ -727,6 +818,140 @@ void syscallDispatchSend(SyscallRequest *req) {
     }
 }
 
+void syscallDispatchRecvMmsg(SyscallRequest *req) {
+    struct mmsghdr msgvec[SOCKET_MMSG_MAX];
+    int vlen = syscallCopyBatch(req, msgvec);
+    if(vlen >= 0) {
+        int status = recvmmsg(req->thread, req->params[0], msgvec, vlen, req->params[3]);
+        syscallReturnBatch(req, msgvec, vlen);
+
+        // block the thread if necessary
+        if(status == -EWOULDBLOCK || status == -EAGAIN) {
+            Process *p = getProcess(req->thread->pid);
+            if(!(p->io[req->params[0]].flags & O_NONBLOCK)) {
+                req->unblock = false;
+                req->busy = false;
+                req->queued = true;
+                req->next = NULL;
+                syscallEnqueue(req);
+                return;
+            }
+        }
+
+        req->ret = status;
+        req->unblock = true;
+    }
+}
+
+void syscallDispatchPipe(SyscallRequest *req) {
+    if(syscallVerifyPointer(req, req->params[0], 2 * sizeof(int))) {
+        req->ret = pipe(req->thread, (int *) req->params[0], req->params[1]);
+        req->unblock = true;
+    }
+}
+
+void syscallDispatchSocketpair(SyscallRequest *req) {
+    if(syscallVerifyPointer(req, req->params[3], 2 * sizeof(int))) {
+        req->ret = socketpair(req->thread, req->params[0], req->params[1], req->params[2], (int *) req->params[3]);
+        req->unblock = true;
+    }
+}
+
+void syscallDispatchSetSockOpt(SyscallRequest *req) {
+    if(syscallVerifyPointer(req, req->params[0], sizeof(struct SockoptSyscallParams))) {
+        // work on a copy so the pointer can't change after it was verified
+        struct SockoptSyscallParams p;
+        memcpy(&p, (const void *) req->params[0], sizeof(struct SockoptSyscallParams));
+        if(syscallVerifyPointer(req, (uintptr_t) p.value, p.len)) {
+            req->ret = setsockopt(req->thread, p.sd, p.level, p.option, p.value, p.len);
+            req->unblock = true;
+        }
+    }
+}
+
+void syscallDispatchGetSockOpt(SyscallRequest *req) {
+    if(syscallVerifyPointer(req, req->params[0], sizeof(struct SockoptSyscallParams))) {
+        struct SockoptSyscallParams p;
+        memcpy(&p, (const void *) req->params[0], sizeof(struct SockoptSyscallParams));
+        if(syscallVerifyPointer(req, (uintptr_t) p.value, p.len)) {
+            req->ret = getsockopt(req->thread, p.sd, p.level, p.option, p.value, &p.len);
+            ((struct SockoptSyscallParams *) req->params[0])->len = p.len;
+            req->unblock = true;
+        }
+    }
+}
+
+/* syscallWaitReady(): completes or re-queues a readiness wait
+ * params: req - syscall request
+ * params: status - status returned by poll() or epoll_wait()
+ * params: timeout - timeout in milliseconds, negative for none
+ * returns: nothing
+ */
+
+static void syscallWaitReady(SyscallRequest *req, int status, int timeout) {
+    if(status == -EWOULDBLOCK) {
+        // the deadline is set on the first attempt only
+        if(timeout > 0 && !req->retry)
+            req->deadline = platformUptime() + ((uint64_t) timeout * PLATFORM_TIMER_FREQUENCY + 999) / 1000;
+
+        if(timeout < 0 || (timeout > 0 && platformUptime() < req->deadline)) {
+            // block by putting the syscall back in the queue
+            req->unblock = false;
+            req->busy = false;
+            req->queued = true;
+            req->next = NULL;
+            syscallEnqueue(req);
+            return;
+        }
+
+        status = 0;     // timed out
+    }
+
+    req->ret = status;
+    req->unblock = true;
+}
+
+void syscallDispatchPoll(SyscallRequest *req) {
+    // bound the count before it is used to size the array so it can't wrap
+    if(req->params[1] > MAX_IO_DESCRIPTORS) {
+        req->ret = -EINVAL;
+        req->unblock = true;
+        return;
+    }
+
+    if(syscallVerifyPointer(req, req->params[0], req->params[1] * sizeof(struct pollfd))) {
+        int status = poll(req->thread, (struct pollfd *) req->params[0], req->params[1]);
+        syscallWaitReady(req, status, (int) req->params[2]);
+    }
+}
+
+void syscallDispatchEpollCreate(SyscallRequest *req) {
+    req->ret = epoll_create(req->thread, req->params[0]);
+    req->unblock = true;
+}
+
+void syscallDispatchEpollCtl(SyscallRequest *req) {
+    if((req->params[1] == EPOLL_CTL_DEL) ||
+    syscallVerifyPointer(req, req->params[3], sizeof(struct epoll_event))) {
+        req->ret = epoll_ctl(req->thread, req->params[0], req->params[1], req->params[2],
+            (struct epoll_event *) req->params[3]);
+        req->unblock = true;
+    }
+}
+
+void syscallDispatchEpollWait(SyscallRequest *req) {
+    if(!req->params[2] || (req->params[2] > MAX_IO_DESCRIPTORS)) {
+        req->ret = -EINVAL;
+        req->unblock = true;
+        return;
+    }
+
+    if(syscallVerifyPointer(req, req->params[1], req->params[2] * sizeof(struct epoll_event))) {
+        int status = epoll_wait(req->thread, req->params[0], (struct epoll_event *) req->params[1], req->params[2]);
+        syscallWaitReady(req, status, (int) req->params[3]);
+    }
+}
+
 void syscallDispatchKill(SyscallRequest *req) {
     req->ret = kill(req->thread, req->params[0], req->params[1]);
     req->unblock = true;
@@ -929,4 +1154,22 @@ void (*syscallDispatchTable[])(SyscallRequest *) = {
     syscallDispatchMMIO,        // 64 - mmio()
     syscallDispatchPContig,     // 65 - pcontig()
     syscallDispatchVToP,        // 66 - vtop()
+
+    /* group 3 continued: socket options */
+    syscallDispatchSetSockOpt,  // 67 - setsockopt()
+    syscallDispatchGetSockOpt,  // 68 - getsockopt()
+
+    /* group 3 continued: readiness notification */
+    syscallDispatchPoll,        // 69 - poll()
+    syscallDispatchEpollCreate, // 70 - epoll_create()
+    syscallDispatchEpollCtl,    // 71 - epoll_ctl()
+    syscallDispatchEpollWait,   // 72 - epoll_wait()
+
+    /* group 3 continued: batched socket I/O */
+    syscallDispatchSendMmsg,    // 73 - sendmmsg()
+    syscallDispatchRecvMmsg,    // 74 - recvmmsg()
+
+    /* group 3 continued: pipes */
+    syscallDispatchPipe,        // 75 - pipe()
+    syscallDispatchSocketpair,  // 76 - socketpair()
 };
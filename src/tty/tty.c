@@ -15,6 +15,7 @@
 #include <kernel/tty.h>
 #include <kernel/memory.h>
 #include <kernel/logger.h>
+#include <platform/platform.h>
 
 KTTY ktty;
 static lock_t lock = LOCK_INITIAL;
@@ -52,6 +53,7 @@ void ttyInit(KernelBootInfo *boot) {
     ktty.hc = ktty.h / FONT_HEIGHT;
     ktty.pitch = boot->pitch;
     ktty.fb = (uint32_t *)boot->framebuffer;
+    ktty.fbPhysical = boot->framebuffer;
     ktty.bg = ttyColors[0];
     ktty.fg = ttyColors[7];
     ktty.bpp = boot->bpp;
@@ -94,6 +96,20 @@ void ttyCreateBackbuffer() {
     ktty.fb = ktty.fbhw;
     ktty.fbhw = temp;
 
+    // the frame buffer is only ever written to in large sequential blocks, so
+    // map it again with write-combining instead of going through the cached
+    // mapping of physical memory
+    size_t pages = ((ktty.pitch*ktty.h) + PAGE_SIZE - 1) / PAGE_SIZE;
+    uintptr_t wc = vmmAllocate(KERNEL_HEAP_BASE, KERNEL_HEAP_LIMIT, pages, VMM_WRITE);
+    if(wc) {
+        for(size_t i = 0; i < pages; i++) {
+            platformMapPage(wc + (i * PAGE_SIZE), ktty.fbPhysical + (i * PAGE_SIZE),
+                PLATFORM_PAGE_PRESENT | PLATFORM_PAGE_WRITE | PLATFORM_PAGE_WRITE_COMBINE);
+        }
+
+        ktty.fbhw = (uint32_t *) wc;
+    }
+
     memcpy(ktty.fb, ktty.fbhw, ktty.pitch*ktty.h);
 }
 